@@ -0,0 +1,30 @@
+# tinyconfig_embed(<target> <file.conf> [NAME <symbol>])
+#
+# Parse file.conf at build time with the tinyconfig_embed tool and add the generated C file to
+# target. The generated file defines a `tc_config <symbol>` that is ready to use, declare it with
+# `extern tc_config <symbol>;`. The symbol defaults to the file name as a C identifier, so
+# tiny.conf becomes tiny_conf.
+#
+# The tinyconfig_embed executable target must exist and be built with the same TC_LINE_MAX_SIZE
+# as target, and the TC_CONFIG_MAX_SIZE of target must hold every line of file.conf. Both are
+# checked when the generated file is compiled.
+function(tinyconfig_embed target file)
+    cmake_parse_arguments(EMBED "" "NAME" "" ${ARGN})
+
+    get_filename_component(input ${file} ABSOLUTE)
+    if(NOT EMBED_NAME)
+        get_filename_component(file_name ${file} NAME)
+        string(MAKE_C_IDENTIFIER ${file_name} EMBED_NAME)
+    endif()
+
+    set(output ${CMAKE_CURRENT_BINARY_DIR}/tinyconfig_embedded/${EMBED_NAME}.c)
+    add_custom_command(
+        OUTPUT ${output}
+        COMMAND ${CMAKE_COMMAND} -E make_directory ${CMAKE_CURRENT_BINARY_DIR}/tinyconfig_embedded
+        COMMAND tinyconfig_embed ${input} ${output} ${EMBED_NAME}
+        DEPENDS tinyconfig_embed ${input}
+        COMMENT "Embedding ${file} as ${EMBED_NAME}"
+        VERBATIM
+    )
+    target_sources(${target} PRIVATE ${output})
+endfunction()
@@ -10,10 +10,10 @@ void print_config(tc_config *config) {
     for (size_t i = 0; i < config->size; i++) {
         void *current_line = (char *) config->buffer + (TC_LINE_TOTAL_SIZE * i);
 
-        // Read the size_t at the beginning of the line.
+        // Read the size_t at the beginning of the line, it holds the value offset and length.
         void *key_start = (char *) current_line;
-        size_t *line_size = (size_t *) key_start;
-        printf("%zi ", *line_size);
+        size_t *header = (size_t *) key_start;
+        printf("%zi %zi ", *header & TC_HEADER_OFFSET_MASK, *header >> TC_HEADER_LENGTH_SHIFT);
 
         // Read the rest of the line past the TC_HEADER_SIZE (which is just sizeof(size_t))
         char *key_value = (char *) key_start + TC_HEADER_SIZE;
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -19,19 +20,255 @@ extern "C" {
 #define TC_LINE_MAX_SIZE 64
 #endif
 
+#ifndef TC_INDEX_SIZE
+#define TC_INDEX_SIZE (TC_CONFIG_MAX_SIZE * 2)
+#endif
+
+#ifndef TC_GROW_CHUNK_LINES
+#define TC_GROW_CHUNK_LINES 64
+#endif
+
+// Byte of the key hash kept by compact line headers.
+#define TC_HEADER_HASH(hash) ((uint8_t) ((hash) >> 24))
+
+#ifdef TC_COMPACT_HEADER
+#if TC_LINE_MAX_SIZE <= 255
+typedef uint8_t tc_header_field;
+#else
+typedef uint16_t tc_header_field;
+#endif
+/// Compact line header: the value offset (key length + 1), the value length and a byte of the
+/// key hash, in fields of one byte, or two bytes when TC_LINE_MAX_SIZE is over 255.
+typedef struct {
+    tc_header_field offset;
+    tc_header_field length;
+    uint8_t         hash;
+} tc_line_header;
+#define TC_HEADER_INIT(offset, length, hash) \
+    { (tc_header_field) (offset), (tc_header_field) (length), (uint8_t) (hash) }
+#define TC_HEADER_SIZE sizeof(tc_line_header)
+// Slots are rounded up to 4 bytes so that every header stays aligned.
+#define TC_LINE_TOTAL_SIZE ((TC_LINE_MAX_SIZE + TC_HEADER_SIZE + 3) / 4 * 4)
+#else
+// The header stores the value offset on its lower half and the value length on its upper half.
+typedef size_t tc_line_header;
+#define TC_HEADER_LENGTH_SHIFT (sizeof(size_t) * 4)
+#define TC_HEADER_OFFSET_MASK  (((size_t) 1 << TC_HEADER_LENGTH_SHIFT) - 1)
+#define TC_HEADER_INIT(offset, length, hash) \
+    ((size_t) (offset) | ((size_t) (length) << TC_HEADER_LENGTH_SHIFT))
 #define TC_HEADER_SIZE sizeof(size_t)
 #define TC_LINE_TOTAL_SIZE (TC_LINE_MAX_SIZE + TC_HEADER_SIZE)
+#endif
+
+/// Entry of the open addressing hash index used to find keys. line stores the line position + 1,
+/// so that an entry with line 0 is empty.
+typedef struct {
+    uint32_t hash;
+    uint32_t line;
+} tc_index_entry;
+
+/// Options read by tc_load_config from tc_config.flags.
+enum {
+    /// Index the keys at load and copy each value on its first access, see "Lazy loading".
+    TC_LAZY = 1 << 0,
+    /// Keep the file buffer and return values that point inside of it, see "Lazy loading and views".
+    TC_VIEW = 1 << 1,
+    /// Lex big files on multiple threads, see "Parallel parsing".
+    TC_PARALLEL = 1 << 2,
+    /// Set by tc_load_configs on configs that own their line buffer and index, tc_free_config
+    /// releases them.
+    TC_OWNED = 1 << 3,
+    /// Store the lines in chunks of TC_GROW_CHUNK_LINES that are allocated as the config grows,
+    /// without the TC_CONFIG_MAX_SIZE limit.
+    TC_GROW = 1 << 4,
+    /// Count the reads of each line in tc_config.access_counts, for tc_optimize_layout and
+    /// tc_export_profile.
+    TC_PROFILE = 1 << 5,
+    /// Keep the generation that last changed each line, for tc_key_generation.
+    TC_LINE_GENERATIONS = 1 << 6,
+    /// Set on the read only configs returned by tc_snapshot.
+    TC_SNAPSHOT = 1 << 7,
+    /// Look keys up through a cache kept by each thread, see "Read cache".
+    TC_READ_CACHE = 1 << 8,
+};
+
+/// Value returned alongside its length, ptr is NULL when the key doesn't exist.
+typedef struct {
+    const char *ptr;
+    size_t      len;
+} tc_str;
+
+/// Allocation callbacks, free receives the size given to alloc. Set one on tc_config.allocator,
+/// or for every config with tc_set_allocator.
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void  (*free)(void *ctx, void *ptr, size_t size);
+    void   *ctx;
+} tc_allocator;
+
+/// Buffer that files are read into, kept by the config between loads so that reloads don't
+/// allocate. A buffer given with tc_set_scratch is borrowed, it is never reallocated nor freed.
+typedef struct {
+    char   *data;
+    size_t  capacity;
+    bool    borrowed;
+} tc_scratch;
+
+/// Key hashes ordered from the most to the least read key, written by tc_export_profile. A
+/// profile set on tc_config.profile is applied by every load, hot keys get the first lines.
+typedef struct {
+    const uint32_t *hashes;
+    size_t          count;
+} tc_profile;
+
+/// What tc_reload_if_changed knows about the file last loaded into a config.
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t  modified_seconds;
+    int64_t  modified_nanoseconds;
+    uint64_t content_hash;
+    bool     has_stat;
+    bool     has_hash;
+} tc_fingerprint;
+
+typedef struct tc_config tc_config;
+typedef struct tc_subscription tc_subscription;
+typedef struct tc_pending tc_pending;
+typedef struct tc_change tc_change;
+typedef struct tc_shared tc_shared;
+typedef struct tc_storage tc_storage;
+
+/// Called by tc_subscribe subscriptions with the new value of their key, value.ptr is NULL when
+/// the key no longer exists.
+typedef void (*tc_callback)(tc_config *config, const char *key, tc_str value, void *ctx);
+
+#ifndef TC_EPOCH_READERS
+#define TC_EPOCH_READERS 64
+#endif
+
+#ifndef TC_RETIRE_BATCH
+#define TC_RETIRE_BATCH 32
+#endif
+
+#ifndef TC_READ_CACHE_SIZE
+#define TC_READ_CACHE_SIZE 64
+#endif
+
+#ifndef TC_ERROR_MAX_SIZE
+#define TC_ERROR_MAX_SIZE 128
+#endif
+
+/// What made tc_reload_staged fail.
+enum {
+    TC_ERROR_NONE,
+    /// The file couldn't be read, or is empty.
+    TC_ERROR_READ,
+    /// The file isn't a valid config, or doesn't fit in the config.
+    TC_ERROR_PARSE,
+    /// The validator rejected the staging config.
+    TC_ERROR_VALIDATION,
+    /// Memory couldn't be allocated, either for the staging config (the live config is kept) or
+    /// for the TC_LINE_GENERATIONS generations of the replaced config.
+    TC_ERROR_MEMORY,
+};
+
+/// Error details of tc_reload_staged, message holds the first error reported while loading or the
+/// one written by the validator.
+typedef struct {
+    int  kind;
+    char message[TC_ERROR_MAX_SIZE];
+} tc_error;
+
+/// Called by tc_reload_staged with the staging config before it replaces the live one. Returning
+/// false keeps the live config, the reason can be written to error->message.
+typedef bool (*tc_validator)(tc_config *staged, void *ctx, tc_error *error);
+
+/// Changes recorded by tc_txn_set, written all at once by tc_txn_commit. The values are written in
+/// place: readers that use tc_get_value_copy or tc_get_values_copy see all of them or none, but
+/// tc_get_value and tc_get_value_sv on another thread can see part of a commit.
+typedef struct {
+    tc_config *config;
+    tc_change *changes;
+    size_t     count;
+    size_t     capacity;
+    bool       failed;
+} tc_txn;
 
 /// tc_config works as a Pool allocator but without a free list. We don't
 /// need to know the
-typedef struct {
-    void      *buffer;
-    size_t     size;
-} tc_config;
+struct tc_config {
+    void               *buffer;
+    size_t              size;
+    tc_index_entry     *index;
+    size_t              index_size;
+    unsigned int        flags;
+    char               *source;
+    size_t              source_capacity;
+    tc_scratch          scratch;
+    const tc_allocator *allocator;
+    void              **chunks;
+    size_t              chunk_count;
+    uint32_t           *access_counts;
+    size_t              access_capacity;
+    tc_profile          profile;
+    uint32_t            sequence;
+    uint32_t            generation;
+    uint32_t           *line_generations;
+    size_t              line_generations_capacity;
+    tc_subscription    *subscriptions;
+    size_t              subscription_count;
+    size_t              subscription_capacity;
+    size_t              subscription_depth;
+    uint32_t            notifier;
+    tc_fingerprint      fingerprint;
+    tc_pending         *pending;
+    tc_shared          *shared;
+    tc_storage         *storage;
+};
 extern bool tc_load_config(tc_config *config, const char *file_path);
+extern bool tc_reload_if_changed(tc_config *config, const char *file_path);
+extern bool tc_reload_staged(
+    tc_config *config, const char *file_path, tc_validator validate, void *ctx, tc_error *error
+);
+extern bool tc_load_directory(tc_config *config, const char *directory, const char *pattern);
+extern bool tc_load_configs(tc_config *configs, const char *const *file_paths, size_t count);
 extern char *tc_get_value(tc_config *config, const char *key_name);
+extern tc_str tc_get_value_sv(tc_config *config, const char *key_name);
+extern tc_str tc_get_value_copy(tc_config *config, const char *key_name, char *buffer, size_t capacity);
+extern size_t tc_get_values_copy(
+    tc_config *config, const char *const *key_names, tc_str *values, size_t count, char *buffer, size_t capacity
+);
+extern void tc_read_enter(void);
+extern void tc_read_leave(void);
+extern size_t tc_reclaim(void);
 extern char *tc_set_value(tc_config *config, char *key, char *new_value);
+extern bool tc_reserve_pending(tc_config *config, size_t capacity);
+extern bool tc_queue_set_value(tc_config *config, const char *key_name, const char *new_value);
+extern size_t tc_apply_pending(tc_config *config);
+extern void tc_txn_begin(tc_config *config, tc_txn *txn);
+extern bool tc_txn_set(tc_txn *txn, const char *key_name, const char *new_value);
+extern bool tc_txn_commit(tc_txn *txn);
+extern void tc_txn_abort(tc_txn *txn);
+/// Read only copy of the current lines of a TC_GROW config, it shares the chunks until they're
+/// written. NULL for configs without TC_GROW, for a source in a borrowed scratch buffer (see
+/// tc_set_scratch) and when memory runs out. The first snapshot after a TC_LAZY load (without
+/// TC_VIEW) copies the values still left in the source, O(n) in the lines of the config, the
+/// following ones are O(1).
+extern tc_config *tc_snapshot(tc_config *config);
+extern tc_config *tc_snapshot_retain(tc_config *snapshot);
+extern void tc_snapshot_release(tc_config *snapshot);
 extern bool tc_save_to_file(tc_config *config, const char *file_path);
+extern void tc_free_config(tc_config *config);
+extern void tc_set_scratch(tc_config *config, void *scratch, size_t capacity);
+extern void tc_set_allocator(const tc_allocator *allocator);
+extern uint32_t tc_generation(tc_config *config);
+extern uint32_t tc_key_generation(tc_config *config, const char *key_name);
+extern bool tc_subscribe(tc_config *config, const char *key_name, tc_callback callback, void *ctx);
+extern void tc_unsubscribe(tc_config *config, const char *key_name, tc_callback callback, void *ctx);
+extern bool tc_optimize_layout(tc_config *config);
+extern size_t tc_export_profile(tc_config *config, uint32_t *hashes, size_t capacity);
 
 #ifdef __cplusplus
 }
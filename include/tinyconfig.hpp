@@ -0,0 +1,483 @@
+// Copyright 2023-2024 Alexandre Parra
+// MIT License
+// tinyconfig
+
+/*
+    C++ interface for tinyconfig.
+
+    tc::basic_config is a header only class template that follows the same lexer rules as
+    tc_load_config, but takes its capacities as template parameters instead of the process wide
+    TC_CONFIG_MAX_SIZE and TC_LINE_MAX_SIZE macros. All the storage lives inside of the object, so
+    a config can be placed on the stack, as a class member or as a static variable, and each
+    subsystem can size its config exactly:
+
+        static tc::basic_config<8, 32>     window_config;
+        static tc::basic_config<5000, 128> routing_config;
+
+    Each line is stored in a fixed slot with a small header holding the key and value lengths,
+    the header type is the smallest unsigned integer able to hold LineSize.
+
+    With C++20 the same lexer also runs at compile time. tc::embedded parses a string literal (or an
+    array filled by #embed) inside of a consteval function and produces a constant, pre-indexed
+    table that lives in .rodata, a syntax error in the embedded config fails the build:
+
+        static constexpr auto &defaults = tc::embedded<"window_width=800\nwindow_height=600\n">;
+        static_assert(defaults.get_view("window_width") == "800");
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+
+#include "tinyconfig.h"
+
+namespace tc {
+
+namespace detail {
+
+/// Smallest unsigned type able to store any offset inside of a line with LineSize bytes.
+template <std::size_t LineSize>
+using line_header_t = std::conditional_t<(LineSize <= UINT8_MAX), std::uint8_t,
+                      std::conditional_t<(LineSize <= UINT16_MAX), std::uint16_t, std::size_t>>;
+
+/// Copy length bytes from source into target. The loop is bounded by the compile time LineSize so
+/// the compiler can unroll and vectorize it for small lines.
+template <std::size_t LineSize>
+constexpr void line_copy(char *target, const char *source, std::size_t length)
+{
+    for (std::size_t i = 0; i < LineSize; i++)
+    {
+        if (i == length) break;
+        target[i] = source[i];
+    }
+}
+
+/// Compare length bytes of two keys, bounded by the compile time LineSize.
+template <std::size_t LineSize>
+constexpr bool line_compare(const char *a, const char *b, std::size_t length)
+{
+    for (std::size_t i = 0; i < LineSize; i++)
+    {
+        if (i == length) return true;
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+/// FNV-1a, used to index the keys of the compile time configs.
+constexpr std::uint32_t hash(std::string_view key)
+{
+    std::uint32_t hash = 2166136261u;
+    for (char c : key)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+/// Error produced by the lexer, line is the zero based index of the line being stored.
+struct parse_error {
+    const char  *message = nullptr;
+    std::size_t  line    = 0;
+
+    constexpr explicit operator bool() const { return message != nullptr; }
+};
+
+/// Lexer shared by every C++ config type, it follows the same rules as tc_parse_config. Every
+/// key-value pair found is handed to sink(key, value) and the sink returns an error message
+/// when it can't store the pair (nullptr otherwise).
+template <typename Sink>
+constexpr parse_error parse(std::string_view source, Sink &&sink)
+{
+    std::string_view key;
+    bool reading_value = false;
+    std::size_t line   = 0;
+    std::size_t size   = source.size();
+
+    for (std::size_t pos = 0; pos < size; pos++)
+    {
+        char c = source[pos];
+        switch (c)
+        {
+        case '\r':
+        case '\n':
+        case ' ':
+        case '\t': break;
+        case '#':
+        {
+            while (pos + 1 < size && source[pos+1] != '\n') pos++;
+            break;
+        }
+        case '=':
+        {
+            if (key.empty()) return { "value without a key", line };
+            reading_value = true;
+            break;
+        }
+        default:
+        {
+            std::size_t start_pos = pos;
+
+            if (reading_value)
+            {
+                if (!(is_alpha(c) || is_digit(c) || c == '-' || c == '.'))
+                    return { "invalid initial value character", line };
+
+                while (pos + 1 < size)
+                {
+                    c = source[pos+1];
+                    if (c == '\0') return { "value has an illegal character", line };
+                    if (c == '\r' || c == '\n' || c == '#') break;
+                    pos++;
+                }
+
+                std::size_t end = pos;
+                while (end > start_pos && source[end] == ' ') end--;
+
+                const char *error = sink(key, source.substr(start_pos, end - start_pos + 1));
+                if (error) return { error, line };
+
+                line += 1;
+                key = {};
+                reading_value = false;
+            }
+            else
+            {
+                if (is_alpha(c))
+                {
+                    while (pos + 1 < size && (is_alpha(c = source[pos+1]) || c == '_')) pos++;
+                }
+                else if (is_digit(c))
+                {
+                    while (pos + 1 < size && is_digit(source[pos+1])) pos++;
+                }
+                else
+                {
+                    return { "key starts with illegal character", line };
+                }
+
+                key = source.substr(start_pos, pos - start_pos + 1);
+            }
+
+            break;
+        }
+        }
+    }
+
+    return {};
+}
+
+} // namespace detail
+
+/// Config with MaxLines slots of LineSize bytes each, stored inline.
+template <std::size_t MaxLines, std::size_t LineSize = TC_LINE_MAX_SIZE>
+class basic_config {
+public:
+    static_assert(MaxLines > 0, "a config needs at least one line");
+    static_assert(LineSize > 3, "a line needs space for a key, '=', a value and '\\0'");
+
+    using header_type = detail::line_header_t<LineSize>;
+
+    static constexpr std::size_t max_lines = MaxLines;
+    static constexpr std::size_t line_size = LineSize;
+
+    /// Reset the config and parse source into it. On error the config is left empty.
+    constexpr detail::parse_error parse(std::string_view source)
+    {
+        size_ = 0;
+        detail::parse_error error = detail::parse(source, [this](std::string_view key, std::string_view value) {
+            return store(key, value);
+        });
+        if (error) size_ = 0;
+        return error;
+    }
+
+    /// Read and parse file_path, errors are reported on standard error like tc_load_config.
+    bool load(const char *file_path)
+    {
+        std::FILE *file = std::fopen(file_path, "rb");
+        if (file == nullptr) return false;
+
+        std::fseek(file, 0L, SEEK_END);
+        long file_size = std::ftell(file);
+        std::rewind(file);
+        if (file_size <= 0)
+        {
+            std::fclose(file);
+            return false;
+        }
+
+        std::unique_ptr<char[]> file_buffer(new char[static_cast<std::size_t>(file_size)]);
+        std::size_t bytes_read = std::fread(file_buffer.get(), 1, static_cast<std::size_t>(file_size), file);
+        std::fclose(file);
+        if (bytes_read == 0) return false;
+
+        detail::parse_error error = parse(std::string_view(file_buffer.get(), bytes_read));
+        if (error)
+        {
+            std::fprintf(stderr, "\033[0;31m tinyconfig: %s at line %zu\033[0m\n", error.message, error.line);
+            return false;
+        }
+        return true;
+    }
+
+    /// Null terminated value of key, or nullptr when the key doesn't exist.
+    constexpr const char *get(std::string_view key) const
+    {
+        const line *found = find(key);
+        return found ? &found->text[found->key_length + 1] : nullptr;
+    }
+
+    /// Same as get, but the length is returned alongside the value.
+    constexpr std::string_view get_view(std::string_view key) const
+    {
+        const line *found = find(key);
+        if (!found) return {};
+        return { &found->text[found->key_length + 1], found->value_length };
+    }
+
+    /// Assign a new value to an existing key. Returns nullptr if the key doesn't exist or the new
+    /// value overflows LineSize.
+    constexpr char *set(std::string_view key, std::string_view value)
+    {
+        line *found = const_cast<line *>(find(key));
+        if (!found || value.empty() || key.size() + value.size() + 2 > LineSize) return nullptr;
+
+        char *value_start = &found->text[found->key_length + 1];
+        detail::line_copy<LineSize>(value_start, value.data(), value.size());
+        value_start[value.size()] = '\0';
+        found->value_length = static_cast<header_type>(value.size());
+        return value_start;
+    }
+
+    /// Write every key-value pair to file_path, comments and whitespace aren't preserved.
+    bool save(const char *file_path) const
+    {
+        std::FILE *file = std::fopen(file_path, "w");
+        if (file == nullptr) return false;
+
+        for (std::size_t i = 0; i < size_; i++)
+            std::fprintf(file, "%s\n", lines_[i].text);
+
+        std::fclose(file);
+        return true;
+    }
+
+    constexpr std::size_t size() const { return size_; }
+
+private:
+    struct line {
+        header_type key_length   = 0;
+        header_type value_length = 0;
+        char        text[LineSize] = {};
+    };
+
+    constexpr const char *store(std::string_view key, std::string_view value)
+    {
+        if (size_ == MaxLines) return "amount of lines exceeds MaxLines";
+        // +2 for '=' and '\0'
+        if (key.size() + value.size() + 2 > LineSize) return "line overflows LineSize";
+
+        line &current = lines_[size_];
+        detail::line_copy<LineSize>(current.text, key.data(), key.size());
+        current.text[key.size()] = '=';
+        detail::line_copy<LineSize>(&current.text[key.size() + 1], value.data(), value.size());
+        current.text[key.size() + value.size() + 1] = '\0';
+        current.key_length   = static_cast<header_type>(key.size());
+        current.value_length = static_cast<header_type>(value.size());
+
+        size_ += 1;
+        return nullptr;
+    }
+
+    constexpr const line *find(std::string_view key) const
+    {
+        for (std::size_t i = 0; i < size_; i++)
+        {
+            const line &current = lines_[i];
+            if (current.key_length == key.size()
+                && detail::line_compare<LineSize>(current.text, key.data(), key.size()))
+                return &current;
+        }
+        return nullptr;
+    }
+
+    line        lines_[MaxLines] = {};
+    std::size_t size_            = 0;
+};
+
+#if __cplusplus >= 202002L
+
+/// String literal usable as a template argument. N counts every byte of the array, the source
+/// ends at the first '\0' or at the end of the array when it isn't null terminated (#embed).
+template <std::size_t N>
+struct fixed_string {
+    char data[N] = {};
+
+    constexpr fixed_string(const char (&source)[N])
+    {
+        for (std::size_t i = 0; i < N; i++) data[i] = source[i];
+    }
+
+    constexpr std::string_view view() const
+    {
+        std::size_t length = 0;
+        while (length < N && data[length] != '\0') length++;
+        return { data, length };
+    }
+};
+
+/// Constant key-value table produced by tc::embedded. Lines are stored as "key=value\0" inside
+/// of a single character buffer and indexed by an open addressing hash table.
+template <std::size_t Lines, std::size_t Bytes>
+class static_config {
+public:
+    // Power of two with at least twice the amount of lines, to keep probe sequences short.
+    static constexpr std::size_t index_size = [] {
+        std::size_t size = 2;
+        while (size < Lines * 2) size *= 2;
+        return size;
+    }();
+
+    /// Parse source, only usable at compile time. A syntax error or an overflow stops the constant
+    /// evaluation and fails the build.
+    consteval explicit static_config(std::string_view source);
+
+    /// Null terminated value of key, or nullptr when the key doesn't exist.
+    constexpr const char *get(std::string_view key) const
+    {
+        const entry *found = find(key);
+        return found ? &text_[found->value] : nullptr;
+    }
+
+    constexpr std::string_view get_view(std::string_view key) const
+    {
+        const entry *found = find(key);
+        if (!found) return {};
+        return { &text_[found->value], found->value_length };
+    }
+
+    constexpr std::size_t size() const { return size_; }
+
+    /// Raw "key=value" line at position index, in the same order as the source.
+    constexpr const char *line(std::size_t index) const { return &text_[entries_[index].key]; }
+
+private:
+    struct entry {
+        std::uint32_t hash         = 0;
+        std::size_t   key          = 0;
+        std::size_t   key_length   = 0;
+        std::size_t   value        = 0;
+        std::size_t   value_length = 0;
+    };
+
+    constexpr const entry *find(std::string_view key) const
+    {
+        std::uint32_t key_hash = detail::hash(key);
+        for (std::size_t i = key_hash & (index_size - 1);; i = (i + 1) & (index_size - 1))
+        {
+            std::uint32_t slot = index_[i];
+            if (slot == 0) return nullptr;
+
+            const entry &current = entries_[slot - 1];
+            if (current.hash == key_hash && current.key_length == key.size()
+                && std::string_view(&text_[current.key], current.key_length) == key)
+                return &current;
+        }
+    }
+
+    // Insert a new line, duplicated keys keep the first value like tc_get_value.
+    constexpr const char *store(std::string_view key, std::string_view value)
+    {
+        entry &current = entries_[size_];
+        current.hash         = detail::hash(key);
+        current.key          = used_;
+        current.key_length   = key.size();
+        current.value        = used_ + key.size() + 1;
+        current.value_length = value.size();
+
+        for (char c : key) text_[used_++] = c;
+        text_[used_++] = '=';
+        for (char c : value) text_[used_++] = c;
+        text_[used_++] = '\0';
+
+        size_ += 1;
+        if (find(key) != nullptr) return nullptr;
+
+        std::size_t i = current.hash & (index_size - 1);
+        while (index_[i] != 0) i = (i + 1) & (index_size - 1);
+        index_[i] = static_cast<std::uint32_t>(size_);
+        return nullptr;
+    }
+
+    entry         entries_[Lines == 0 ? 1 : Lines] = {};
+    std::uint32_t index_[index_size]               = {};
+    char          text_[Bytes == 0 ? 1 : Bytes]    = {};
+    std::size_t   size_                            = 0;
+    std::size_t   used_                            = 0;
+};
+
+namespace detail {
+
+/// Amount of lines and text bytes needed to store a source, used to size tc::static_config.
+struct source_extent {
+    std::size_t lines = 0;
+    std::size_t bytes = 0;
+};
+
+consteval source_extent measure(std::string_view source)
+{
+    source_extent extent;
+    detail::parse(source, [&extent](std::string_view key, std::string_view value) -> const char * {
+        extent.lines += 1;
+        // +2 for '=' and '\0'
+        extent.bytes += key.size() + value.size() + 2;
+        return nullptr;
+    });
+    return extent;
+}
+
+/// Not constexpr on purpose, reaching it while parsing an embedded config at compile time makes
+/// the build fail and the compiler points at this name.
+inline void embedded_config_syntax_error(const char *, std::size_t) {}
+
+} // namespace detail
+
+template <std::size_t Lines, std::size_t Bytes>
+consteval static_config<Lines, Bytes>::static_config(std::string_view source)
+{
+    detail::parse_error error = detail::parse(source, [this](std::string_view key, std::string_view value) {
+        if (size_ == Lines || used_ + key.size() + value.size() + 2 > Bytes)
+            return "embedded config doesn't fit its table";
+        return store(key, value);
+    });
+    if (error) detail::embedded_config_syntax_error(error.message, error.line);
+}
+
+/// Parse Source at compile time, the resulting table is sized exactly to the lines in Source.
+template <fixed_string Source>
+consteval auto parse_embedded()
+{
+    constexpr detail::source_extent extent = detail::measure(Source.view());
+    return static_config<extent.lines, extent.bytes>(Source.view());
+}
+
+/// Constant config parsed at compile time, stored in .rodata.
+template <fixed_string Source>
+inline constexpr auto embedded = parse_embedded<Source>();
+
+#endif
+
+/// C++ config sized with the same TC_CONFIG_MAX_SIZE and TC_LINE_MAX_SIZE used by tinyconfig.h.
+using config = basic_config<TC_CONFIG_MAX_SIZE, TC_LINE_MAX_SIZE>;
+
+} // namespace tc
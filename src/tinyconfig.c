@@ -1,6 +1,6 @@
 // Copyright 2023-2024 Alexandre Parra
 // MIT License
-// tinyconfig 3.0.0
+// tinyconfig 3.1.0
 
 /*
     tinyconfig is a minimal, yet flexible configuration file specification, that strives to work for 
@@ -50,20 +50,48 @@ Memory model:
     it using tc_set_value. Each line is always null terminated meaning that you can print it in C 
     with a simple printf("%s").
 
+    Keys are found through an open addressing hash index (linear probing) with TC_INDEX_SIZE
+    entries, each entry keeps the FNV-1a hash of the key and the line position, so a lookup only
+    touches the lines whose hash matches. When a key is duplicated the first line is indexed.
+
+    Besides the value offset, the header keeps the value length on its upper half, so values can
+    be returned alongside their length (tc_get_value_sv) without a strlen.
+
     To guarantee memory alignment, set the macro TC_LINE_MAX_SIZE to a power of two. By default it
     is set to 64, which would result in the correct aligment for most 32 and 64 bit processors.
 
+Lazy loading and views:
+    When config->flags has TC_LAZY, tc_load_config only finds the line boundaries and indexes the
+    key hashes, the file buffer is kept in config->source and each line slot holds a source_line
+    record (with a header set to 0) pointing to the key and value inside of the source. The value
+    is copied and trimmed into the slot the first time it is accessed, so processes that read few
+    keys from big files skip most of the copying.
+
+    TC_VIEW goes further and never copies values, they are trimmed at load and null terminated
+    inside of config->source, and tc_get_value returns pointers into it. Values aren't limited by
+    TC_LINE_MAX_SIZE in this mode. A line is copied into its slot only when tc_set_value changes
+    it.
+
 Hot reload:
     You can easily achieve hot reload in tinyconfig by running tc_load_config again, just provide
     the same configuration file again to the function. Two simple methods to implement hot reload 
     are:
-      1. Check the file stat every time and use tc_load_config to reload once a file has changed.
+      1. Call tc_reload_if_changed periodically, it only reads the file when its stat changed and
+      only parses it when its content changed.
       2. Create a custom command to reload the file on demand, for example, if you have something
       like a REPL or a debug GUI that calls tc_load_config again.
+    tc_load_config parses in place, a file with errors leaves the config half loaded. Use
+    tc_reload_staged when the previous config must be kept, see "Staged reload".
 */
 
+// O_CLOEXEC, AT_FDCWD, st_mtim and MAP_POPULATE are POSIX and Linux extensions, which a strict
+// -std=c17 hides unless they're asked for before the first include.
+#if !defined(_GNU_SOURCE) && (defined(__unix__) || defined(__APPLE__))
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
-#include <ctype.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -73,6 +101,31 @@ Hot reload:
 #include <time.h>
 #endif
 
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#if defined(__linux__) && !defined(TC_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TC_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
 #include <tinyconfig.h>
 
 //---------------------------------------------------------------------------
@@ -95,10 +148,221 @@ Hot reload:
 	#define TC_FTELL ftell
 #endif
 
-#define ERROR_REPORT(string, ...) fprintf(        \
-        stderr,                                       \
-        "\033[0;31m tinyconfig: " string "\033[0m\n", \
-        __VA_ARGS__)
+#define ERROR_REPORT(string, ...) do {                                              \
+        fprintf(stderr, "\033[0;31m tinyconfig: " string "\033[0m\n", __VA_ARGS__); \
+        error_record(string, __VA_ARGS__);                                          \
+    } while (0)
+
+#if defined(_MSC_VER) && !defined(__clang__)
+    #define TC_THREAD_LOCAL __declspec(thread)
+#else
+    #define TC_THREAD_LOCAL _Thread_local
+#endif
+
+//---------------------------------------------------------------------------
+// Memory
+//---------------------------------------------------------------------------
+
+internal void *heap_alloc(void *ctx, size_t size)
+{
+    (void) ctx;
+    return malloc(size);
+}
+
+internal void heap_free(void *ctx, void *ptr, size_t size)
+{
+    (void) ctx;
+    (void) size;
+    free(ptr);
+}
+
+internal const tc_allocator heap_allocator = { .alloc = heap_alloc, .free = heap_free };
+
+/// Used for the memory of configs without an allocator and for temporary memory.
+internal const tc_allocator *global_allocator = &heap_allocator;
+
+/// Allocator of the memory owned by the config.
+internal const tc_allocator *config_allocator(const tc_config *config)
+{
+    return config->allocator != NULL ? config->allocator : global_allocator;
+}
+
+internal void *memory_alloc(const tc_allocator *allocator, size_t size)
+{
+    return allocator->alloc(allocator->ctx, size);
+}
+
+/// Allocate count zeroed elements of size bytes, NULL is returned when the size overflows.
+internal void *memory_calloc(const tc_allocator *allocator, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+
+    void *ptr = memory_alloc(allocator, count * size);
+    if (ptr != NULL) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+internal void memory_free(const tc_allocator *allocator, void *ptr, size_t size)
+{
+    if (ptr != NULL) allocator->free(allocator->ctx, ptr, size);
+}
+
+/// Move the size bytes of ptr to a new allocation of new_size bytes, tc_allocator has no realloc.
+internal void *memory_grow(const tc_allocator *allocator, void *ptr, size_t size, size_t new_size)
+{
+    assert(new_size >= size);
+    void *grown = memory_alloc(allocator, new_size);
+    if (grown == NULL) return NULL;
+
+    if (ptr != NULL) memcpy(grown, ptr, size);
+    memory_free(allocator, ptr, size);
+    return grown;
+}
+
+//---------------------------------------------------------------------------
+// Atomics
+//---------------------------------------------------------------------------
+
+/*
+    Counters shared between threads are plain uint32_t fields of the public structs, so that
+    tinyconfig.h stays usable from C++, and are only accessed through these functions. They map to
+    the GCC and Clang __atomic builtins, or to the Interlocked intrinsics on MSVC, which are full
+    barriers.
+*/
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+internal uint32_t atomic_load_acquire(uint32_t *pointer)
+{
+    return (uint32_t) _InterlockedOr((volatile long *) pointer, 0);
+}
+
+internal void atomic_store_release(uint32_t *pointer, uint32_t value)
+{
+    _InterlockedExchange((volatile long *) pointer, (long) value);
+}
+
+internal bool atomic_compare_exchange(uint32_t *pointer, uint32_t expected, uint32_t desired)
+{
+    return _InterlockedCompareExchange((volatile long *) pointer, (long) desired, (long) expected)
+        == (long) expected;
+}
+
+internal uint32_t atomic_increment(uint32_t *pointer)
+{
+    return (uint32_t) _InterlockedIncrement((volatile long *) pointer);
+}
+
+/// Decrement and return the new value, ordered with the accesses before and after it.
+internal uint32_t atomic_decrement(uint32_t *pointer)
+{
+    return (uint32_t) _InterlockedDecrement((volatile long *) pointer);
+}
+
+internal void atomic_fence_acquire(void)
+{
+    MemoryBarrier();
+}
+
+internal void atomic_fence_release(void)
+{
+    MemoryBarrier();
+}
+
+internal void atomic_fence_full(void)
+{
+    MemoryBarrier();
+}
+
+internal void *atomic_load_pointer_acquire(void **pointer)
+{
+    return _InterlockedCompareExchangePointer(pointer, NULL, NULL);
+}
+
+internal void atomic_store_pointer_release(void **pointer, void *value)
+{
+    _InterlockedExchangePointer(pointer, value);
+}
+#else
+internal uint32_t atomic_load_acquire(uint32_t *pointer)
+{
+    return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+}
+
+internal void atomic_store_release(uint32_t *pointer, uint32_t value)
+{
+    __atomic_store_n(pointer, value, __ATOMIC_RELEASE);
+}
+
+internal bool atomic_compare_exchange(uint32_t *pointer, uint32_t expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(
+        pointer, &expected, desired, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED
+    );
+}
+
+/// Relaxed, only for statistics and counters that just need distinct values. Return the new value.
+internal uint32_t atomic_increment(uint32_t *pointer)
+{
+    return __atomic_add_fetch(pointer, 1, __ATOMIC_RELAXED);
+}
+
+/// Decrement and return the new value, ordered with the accesses before and after it.
+internal uint32_t atomic_decrement(uint32_t *pointer)
+{
+    return __atomic_sub_fetch(pointer, 1, __ATOMIC_ACQ_REL);
+}
+
+internal void atomic_fence_acquire(void)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+internal void atomic_fence_release(void)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/// Orders the stores before it with the loads after it, which acquire and release don't.
+internal void atomic_fence_full(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+internal void *atomic_load_pointer_acquire(void **pointer)
+{
+    return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+}
+
+internal void atomic_store_pointer_release(void **pointer, void *value)
+{
+    __atomic_store_n(pointer, value, __ATOMIC_RELEASE);
+}
+#endif
+
+//---------------------------------------------------------------------------
+// Errors
+//---------------------------------------------------------------------------
+
+/*
+    Errors are reported on standard error by ERROR_REPORT. tc_reload_staged also needs them in the
+    tc_error of its caller, so while it loads, error_sink points to it and the first error
+    reported on that thread is recorded there. Errors of the parsing threads of TC_PARALLEL
+    configs are only reported.
+*/
+
+internal TC_THREAD_LOCAL tc_error *error_sink = NULL;
+
+internal void error_record(const char *format, ...)
+{
+    if (error_sink == NULL || error_sink->message[0] != '\0') return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(error_sink->message, sizeof(error_sink->message), format, arguments);
+    va_end(arguments);
+}
 
 //---------------------------------------------------------------------------
 // Util
@@ -119,24 +383,162 @@ internal bool open_file(FILE** fp, const char* file_path, const char* mode)
     return true;
 }
 
+/// Make room for at least minimum bytes in the scratch buffer, growing it to preferred bytes with
+/// allocator. Borrowed buffers can't grow.
+internal bool scratch_reserve(const tc_allocator *allocator, tc_scratch *scratch, size_t minimum, size_t preferred)
+{
+    if (scratch->capacity >= minimum) return true;
+    if (scratch->borrowed)
+    {
+        ERROR_REPORT("the file doesn't fit in the scratch buffer (%zi bytes)", scratch->capacity);
+        return false;
+    }
+
+    char *data = memory_grow(allocator, scratch->data, scratch->capacity, preferred);
+    if (data == NULL) return false;
+
+    scratch->data     = data;
+    scratch->capacity = preferred;
+    return true;
+}
+
+/// Read the whole file into the scratch buffer and null terminate it, the buffer only grows (with
+/// allocator) when the file doesn't fit. On POSIX this is an open, an fstat, usually one pread
+/// and a close, platforms without pread use stdio.
+internal bool file_read_into(
+    const char *file_path,
+    const tc_allocator *allocator,
+    tc_scratch *scratch,
+    size_t *bytes_read
+) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    // Room for the null terminator and, when the buffer can grow, for one byte more than fstat
+    // reported, so that a read returning less than asked means the end of the file.
+    struct stat file_stat;
+    bool success = fstat(fd, &file_stat) == 0;
+    size_t file_size = success ? (size_t) file_stat.st_size : 0;
+    success = success && scratch_reserve(allocator, scratch, file_size + 1, file_size + 2);
+
+    size_t total = 0;
+    while (success)
+    {
+        size_t asked = scratch->capacity - total - 1;
+        if (asked == 0)
+        {
+            // The buffer is full, check if the file grew after fstat.
+            char probe;
+            ssize_t count = pread(fd, &probe, 1, (off_t) total);
+            if (count < 0 && errno == EINTR) continue;
+            if (count == 0) break;
+            success = count > 0
+                && scratch_reserve(allocator, scratch, scratch->capacity + 1, scratch->capacity * 2);
+            continue;
+        }
+
+        // pread can return less than asked before the end of the file, so reading stops at a read
+        // of 0 or at a short read past the size given by fstat. A file that shrank after fstat
+        // ends early.
+        ssize_t count = pread(fd, &scratch->data[total], asked, (off_t) total);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0)
+        {
+            success = false;
+            break;
+        }
+
+        total += (size_t) count;
+        if (count == 0 || ((size_t) count < asked && total >= file_size)) break;
+    }
+    close(fd);
+    if (!success)
+        return false;
+
+    scratch->data[total] = '\0';
+    *bytes_read = total;
+    return true;
+#else
+    FILE *file;
+    bool ok = open_file(&file, file_path, "rb");
+    if (!ok)
+        return false;
+
+    TC_FSEEK(file, 0L, SEEK_END);
+    size_t file_size = TC_FTELL(file);
+    rewind(file);
+
+    if (!scratch_reserve(allocator, scratch, file_size + 1, file_size + 1))
+    {
+        fclose(file);
+        return false;
+    }
+
+    *bytes_read = fread(scratch->data, sizeof(char), file_size, file);
+    bool failed = ferror(file);
+    fclose(file);
+    if (failed)
+        return false;
+
+    scratch->data[*bytes_read] = '\0';
+    return true;
+#endif
+}
+
+/// Every stored line has an '=', so they bound the amount of lines of a file. The lexer also
+/// writes the key of a last line without one before the file ends, so one more line is counted.
+/// Only TC_GROW configs can have more than TC_CONFIG_MAX_SIZE lines.
+internal size_t file_line_capacity(const char *file_buffer, size_t bytes_read, bool grow)
+{
+    size_t capacity = 1;
+    for (size_t i = 0; i < bytes_read; i++)
+        capacity += file_buffer[i] == '=';
+    return grow || capacity < TC_CONFIG_MAX_SIZE ? capacity : TC_CONFIG_MAX_SIZE;
+}
+
 //---------------------------------------------------------------------------
 // String manipulation
 //---------------------------------------------------------------------------
 
-/// Compare a slice from start to end from the compared string with the base string.
-internal bool key_compare(const char *key, size_t key_end, const char *compared)
+/// Compare the first key_length characters of both keys.
+internal bool key_compare(const char *key, size_t key_length, const char *compared)
 {
-    size_t i;
-    for (i = 0; i < key_end; i++)
+    for (size_t i = 0; i < key_length; i++)
     {
         if (key[i] != compared[i]) return false;
     }
 
-    if (i < key_end) return false;
-
     return true;
 }
 
+/// FNV-1a hash of the first key_length characters of key.
+internal uint32_t key_hash(const char *key, size_t key_length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key_length; i++)
+    {
+        hash ^= (unsigned char) key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// Same as key_hash for a null terminated key, the key length is returned through key_length.
+internal uint32_t key_hash_null(const char *key, size_t *key_length)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; key[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char) key[i];
+        hash *= 16777619u;
+    }
+    *key_length = i;
+    return hash;
+}
+
 /// Copy a slice from start to end from source into target starting from
 /// target_start_from including a terminator character '\0' at the end.
 internal void string_copy_slice_null(
@@ -176,22 +578,94 @@ internal size_t string_trim_end(const char *source, size_t position)
 
 internal void *line_get(tc_config *config, size_t index)
 {
+    if (config->chunks != NULL)
+    {
+        assert(index < config->chunk_count * TC_GROW_CHUNK_LINES);
+        char *chunk = config->chunks[index / TC_GROW_CHUNK_LINES];
+        return chunk + (TC_LINE_TOTAL_SIZE * (index % TC_GROW_CHUNK_LINES));
+    }
+
     assert(index < TC_CONFIG_MAX_SIZE);
     void *ptr = (char *) config->buffer + (TC_LINE_TOTAL_SIZE * index);
     return ptr;
 }
 
+_Static_assert(TC_LINE_MAX_SIZE <= UINT16_MAX, "TC_LINE_MAX_SIZE must fit in half of the line header");
+
+/*
+    Every slot starts with a tc_line_header. By default it's a size_t with the value offset on its
+    lower half and the value length on its upper half. TC_COMPACT_HEADER replaces it with one or
+    two byte fields that also keep a byte of the key hash, so a lookup can reject most lines from
+    the first bytes of their slot without reading the key.
+*/
+
+internal size_t header_offset(void *location)
+{
+#ifdef TC_COMPACT_HEADER
+    return ((tc_line_header *) location)->offset;
+#else
+    return *((tc_line_header *) location) & TC_HEADER_OFFSET_MASK;
+#endif
+}
+
+internal size_t header_length(void *location)
+{
+#ifdef TC_COMPACT_HEADER
+    return ((tc_line_header *) location)->length;
+#else
+    return *((tc_line_header *) location) >> TC_HEADER_LENGTH_SHIFT;
+#endif
+}
+
+/// The key hash byte of the line, always 0 without TC_COMPACT_HEADER.
+internal uint8_t header_hash(void *location)
+{
+#ifdef TC_COMPACT_HEADER
+    return ((tc_line_header *) location)->hash;
+#else
+    (void) location;
+    return 0;
+#endif
+}
+
 internal size_t line_offset_get(tc_config *config, size_t index)
 {
     assert(index <= config->size);
-    return *((size_t *) line_get(config, index));
+    return header_offset(line_get(config, index));
 }
 
-internal void header_write(void *location, size_t key_value_offset)
+internal size_t line_value_length_get(tc_config *config, size_t index)
 {
+    assert(index <= config->size);
+    return header_length(line_get(config, index));
+}
+
+/// Whether the line can hold a key with the given hash, only compact headers can tell them apart.
+internal bool line_hash_match(tc_config *config, size_t index, uint32_t hash)
+{
+#ifdef TC_COMPACT_HEADER
+    return header_hash(line_get(config, index)) == TC_HEADER_HASH(hash);
+#else
+    (void) config;
+    (void) index;
+    (void) hash;
+    return true;
+#endif
+}
+
+/// hash_byte is the TC_HEADER_HASH of the key, it's only kept by compact headers.
+internal void header_write(
+    void *location,
+    size_t key_value_offset,
+    size_t value_length,
+    uint8_t hash_byte
+) {
     assert(location != NULL);
-    size_t *header = location;
-    *header = key_value_offset;
+#ifndef TC_COMPACT_HEADER
+    (void) hash_byte;
+#endif
+    tc_line_header header = TC_HEADER_INIT(key_value_offset, value_length, hash_byte);
+    *((tc_line_header *) location) = header;
 }
 
 internal char *header_read(void *location)
@@ -202,232 +676,3872 @@ internal char *header_read(void *location)
 }
 
 //---------------------------------------------------------------------------
-// Lexer
+// Epochs
 //---------------------------------------------------------------------------
 
-internal bool tc_parse_config(tc_config *config, char *file_buffer, size_t file_bytes_read)
-{
-    assert(config->buffer != NULL);
-    assert(file_bytes_read > 0);
+/*
+    Storage that readers on other threads may still be using isn't released right away, it's
+    retired and released once no reader can hold it anymore. Readers mark where they are with
+    tc_read_enter and tc_read_leave: entering stores the global epoch in a reader slot of the
+    thread, leaving clears it, and neither waits for anything. The slots are claimed by each
+    thread on its first tc_read_enter (and given back when it exits, through a tss destructor)
+    out of TC_EPOCH_READERS, threads that find none are only counted, and no epoch passes while
+    any of them reads.
 
-    char c              = 0;
-    size_t current_line = 0;
-    size_t start_pos    = 0;
-    size_t key_size     = 0;
-    bool reading_value  = false;
+    Each retired block is tagged with the epoch it was retired at. The global epoch advances when
+    every reader inside of a critical section has seen the current one, so after two advances no
+    reader can still hold a block retired before them. Writers retire under retire_lock and the
+    blocks are released in batches of TC_RETIRE_BATCH, tc_reclaim releases what it can right
+    away. A thread that reloads while it's inside of a critical section delays the release of
+    the blocks until it leaves.
+*/
 
-    for (size_t pos = 0; pos < file_bytes_read; pos++)
-    {
-        switch (c = file_buffer[pos])
-        {
-        case '\r':
-        case '\n':
-        case ' ':
-        case '\t': break;
-        case '#':
-        {
-            while ((c = file_buffer[pos+1]) != '\n' || c == '\0') pos++;
-            break;
-        }
-        case '=':
-        {
-            reading_value = true;
-            break;
-        }
-        default:
-        {
-            start_pos = pos;
+typedef struct {
+    uint32_t state; // (epoch << 1) | 1 inside of a critical section, 0 outside
+    uint32_t used;
+    char     padding[64 - 2 * sizeof(uint32_t)];
+} reader_slot;
 
-            if (reading_value)
-            {
-                if (isalpha(c) || isdigit(c) || c == '-' || c == '.')
-                {
-                    for (;;)
-                    {
-                        c = file_buffer[pos+1];
-                        if (c == '\r' || c == '\n' || c == '\0' || c == '#') break;
-                        pos++;
-                    }
-                } 
-                else
-                {
-                    ERROR_REPORT("Invalid initial value character: %c at line %zi",
-                        file_buffer[start_pos],
-                        current_line
-                    );
-                    goto error;
-                }
-
-                size_t value_size = pos - start_pos;
-
-                // +2 for '=' and '\0'
-                if ((value_size + key_size + 2) >= TC_LINE_MAX_SIZE)
-                {
-                    ERROR_REPORT("value at line %zi overflows default TC_LINE_MAX_SIZE (%i)",
-                        current_line,
-                        TC_LINE_MAX_SIZE
-                    );
-                    goto error;
-                }
-
-                char *key_start   = header_read(line_get(config, current_line));
-                char *value_start = &key_start[key_size + 2];
-                size_t trim_end_position = string_trim_end(file_buffer, pos);
-                string_copy_slice_null(
-                    file_buffer,
-                    start_pos,
-                    trim_end_position,
-                    value_start
-                );
+typedef void (*retire_release)(const tc_allocator *allocator, void *data, size_t size);
 
-                current_line += 1;
-                config->size += 1;
-                reading_value = false;
-            }
-            else
-            {
-                if (isalpha(c))
-                {
-                    while (isalpha((c = file_buffer[pos+1])) || c == '_') pos++;
-                }
-                else if (isdigit(c)) 
-                {
-                    while (isdigit(c = file_buffer[pos+1])) pos++;
-                }
-                else
-                {
-                    // Invalid key, skip current_line.
-                    while ((c = file_buffer[pos+1]) != '\n') pos++;
-                    ERROR_REPORT(
-                        "key at line %zi starts with illegal character",
-                        current_line
-                    );
-                    goto error;
-                }
-
-                key_size = (pos - start_pos);
-
-                if (config->size == TC_CONFIG_MAX_SIZE)
-                {
-                    ERROR_REPORT(
-                        "key at line %zi overflows default TC_LINE_MAX_SIZE (%i)",
-                        current_line,
-                        TC_CONFIG_MAX_SIZE
-                    );
-                    goto error;
-                }
-
-                if (key_size >= TC_LINE_MAX_SIZE)
-                {
-                    ERROR_REPORT(
-                        "amount of lines exceeds TC_CONFIG_MAX_SIZE (%i)",
-                        TC_LINE_MAX_SIZE
-                    );
-                    goto error;
-                }
-
-                void *current_location = line_get(config, current_line);
-                // + 2 to land correctly on the start of the value, just after the = sign.
-                header_write(current_location, key_size + 2);
-                assert( *((size_t *) current_location) == key_size + 2);
-
-                void *key_location = header_read(current_location);
-                string_copy_slice(file_buffer, start_pos, pos, key_location);
-
-                char *key = (char *) key_location;
-                key[key_size + 1] = '=';
-            }
+typedef struct {
+    retire_release      release;
+    const tc_allocator *allocator;
+    void               *data;
+    size_t              size;
+    uint32_t            epoch;
+} retired_block;
 
-            break;
-        }
-        }
-    }
+internal uint32_t    epoch_global = 0;
+internal reader_slot reader_slots[TC_EPOCH_READERS];
+internal uint32_t    readers_unregistered = 0;
 
-    free(file_buffer);
-    return true;
+internal TC_THREAD_LOCAL reader_slot *reader = NULL;
+internal TC_THREAD_LOCAL uint32_t     reader_depth = 0;
 
-error:
-    free(file_buffer);
-    return false;
-}
+internal uint32_t            retire_lock = 0;
+internal retired_block      *retired_blocks = NULL;
+internal size_t              retired_count = 0;
+internal size_t              retired_capacity = 0;
+internal const tc_allocator *retired_allocator = NULL;
 
-//---------------------------------------------------------------------------
-// tinyconfig.h
-//---------------------------------------------------------------------------
+#ifndef __STDC_NO_THREADS__
+internal once_flag reader_key_once = ONCE_FLAG_INIT;
+internal tss_t     reader_key;
 
-internal void *buffer[TC_CONFIG_MAX_SIZE * TC_LINE_TOTAL_SIZE] = {0};
+internal void reader_slot_exit(void *slot)
+{
+    atomic_store_release(&((reader_slot *) slot)->state, 0);
+    atomic_store_release(&((reader_slot *) slot)->used, 0);
+}
 
-extern bool tc_load_config(tc_config *config, const char *file_path)
+internal void reader_key_create(void)
 {
-    assert(config != NULL);
-#ifndef NDEBUG
-    double startTime = (double) clock() / CLOCKS_PER_SEC;
+    tss_create(&reader_key, reader_slot_exit);
+}
+#endif
+
+/// Claim a free reader slot for the thread, NULL when every slot is taken.
+internal reader_slot *reader_slot_claim(void)
+{
+    for (size_t i = 0; i < TC_EPOCH_READERS; i++)
+    {
+        reader_slot *slot = &reader_slots[i];
+        if (atomic_load_acquire(&slot->used) != 0 || !atomic_compare_exchange(&slot->used, 0, 1))
+            continue;
+
+#ifndef __STDC_NO_THREADS__
+        call_once(&reader_key_once, reader_key_create);
+        tss_set(reader_key, slot);
+#endif
+        return slot;
+    }
+    return NULL;
+}
+
+/// Advance the global epoch if every reader inside of a critical section has seen it.
+internal bool epoch_try_advance(void)
+{
+    uint32_t epoch = atomic_load_acquire(&epoch_global);
+
+    // The blocks were unlinked before, so readers that enter after these loads can't find them.
+    atomic_fence_full();
+    if (atomic_load_acquire(&readers_unregistered) != 0) return false;
+
+    for (size_t i = 0; i < TC_EPOCH_READERS; i++)
+    {
+        uint32_t state = atomic_load_acquire(&reader_slots[i].state);
+        if ((state & 1) && (state >> 1) != (epoch & (UINT32_MAX >> 1))) return false;
+    }
+
+    atomic_store_release(&epoch_global, epoch + 1);
+    return true;
+}
+
+internal void retire_lock_acquire(void)
+{
+    while (!atomic_compare_exchange(&retire_lock, 0, 1)) {}
+}
+
+internal void retire_lock_release(void)
+{
+    atomic_store_release(&retire_lock, 0);
+}
+
+/// Release the blocks retired two epochs ago or earlier, under retire_lock.
+internal void epoch_reclaim(void)
+{
+    epoch_try_advance();
+    uint32_t epoch = atomic_load_acquire(&epoch_global);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_count; i++)
+    {
+        retired_block block = retired_blocks[i];
+        if (epoch - block.epoch >= 2) block.release(block.allocator, block.data, block.size);
+        else retired_blocks[kept++] = block;
+    }
+    retired_count = kept;
+}
+
+/// Release data with release(allocator, data, size) once no reader can hold it. When the retired
+/// list is full and can't grow, the blocks that can be released make room, and when none can the
+/// writer waits for the readers to leave. It waits outside of retire_lock, so the other writers
+/// keep retiring meanwhile.
+internal void epoch_retire(retire_release release, const tc_allocator *allocator, void *data, size_t size)
+{
+    if (data == NULL) return;
+
+    retire_lock_acquire();
+    if (retired_count == retired_capacity) epoch_reclaim();
+    if (retired_count == retired_capacity)
+    {
+        size_t capacity = retired_capacity > 0 ? retired_capacity * 2 : TC_RETIRE_BATCH;
+        retired_block *blocks = memory_alloc(global_allocator, capacity * sizeof(retired_block));
+        if (blocks == NULL)
+        {
+            // Loaded after the block was unlinked, like the epoch of retired blocks.
+            uint32_t epoch = atomic_load_acquire(&epoch_global);
+            retire_lock_release();
+
+            assert(reader_depth == 0);
+            while (atomic_load_acquire(&epoch_global) - epoch < 2) epoch_try_advance();
+            release(allocator, data, size);
+            return;
+        }
+
+        if (retired_blocks != NULL)
+        {
+            memcpy(blocks, retired_blocks, retired_count * sizeof(retired_block));
+            memory_free(retired_allocator, retired_blocks, retired_capacity * sizeof(retired_block));
+        }
+        retired_blocks    = blocks;
+        retired_capacity  = capacity;
+        retired_allocator = global_allocator;
+    }
+
+    retired_blocks[retired_count++] = (retired_block) {
+        .release   = release,
+        .allocator = allocator,
+        .data      = data,
+        .size      = size,
+        .epoch     = atomic_load_acquire(&epoch_global),
+    };
+    if (retired_count >= TC_RETIRE_BATCH) epoch_reclaim();
+    retire_lock_release();
+}
+
+//---------------------------------------------------------------------------
+// Storage records
+//---------------------------------------------------------------------------
+
+/*
+    Readers that run while another thread reloads (tc_get_value_copy, and the readers between
+    tc_read_enter and tc_read_leave) can't read the storage fields of the config one by one, they
+    could pair the index of one load with the index_size of the next one. Every load publishes
+    the storage it ends with in a tc_storage record instead, a read only config that only has the
+    storage fields, with a single release store to config->storage. Readers load the pointer once
+    and look keys up in the record, so they see one load or the other but never a mix of both.
+
+    A published record is never modified. Every config alternates between two records: the one
+    it publishes keeps the previous one as its spare, tagged with the epoch it was unpublished at,
+    and the next load reuses the spare once two epochs passed, when no reader can hold it anymore
+    (see "Epochs"). So steady reloads don't touch the allocator. A new record is only allocated
+    while a reader still holds the spare, which is retired then. Configs that weren't loaded by
+    tinyconfig (tinyconfig_embed) have no record and are read directly.
+
+    Each record also gets a number from storage_loads when it's published, which tells loads apart
+    even when a config is cleared without tc_free_config and loaded again at the same address and
+    generation, or when a record is reused.
+*/
+
+struct tc_storage {
+    tc_config           view;
+    uint32_t            load;
+    uint32_t            spare_epoch;
+    tc_storage         *spare;     // previous record, only read by the writers of the config
+    const tc_allocator *allocator; // allocator of the record itself
+};
+
+internal uint32_t storage_loads = 0;
+
+internal tc_storage *storage_alloc(tc_config *config)
+{
+    const tc_allocator *allocator = config_allocator(config);
+    tc_storage *storage = memory_alloc(allocator, sizeof(tc_storage));
+    if (storage != NULL) *storage = (tc_storage) { .allocator = allocator };
+    return storage;
+}
+
+internal void storage_release(const tc_allocator *allocator, void *storage, size_t size)
+{
+    memory_free(allocator, storage, size);
+}
+
+/// Free the record and its spare, no reader may hold them.
+internal void storage_free(tc_storage *storage)
+{
+    if (storage == NULL) return;
+    if (storage->spare != NULL) memory_free(storage->spare->allocator, storage->spare, sizeof(tc_storage));
+    memory_free(storage->allocator, storage, sizeof(tc_storage));
+}
+
+/// Release the record and its spare once no reader can hold them.
+internal void storage_retire(tc_storage *storage)
+{
+    if (storage == NULL) return;
+    if (storage->spare != NULL)
+        epoch_retire(storage_release, storage->spare->allocator, storage->spare, sizeof(tc_storage));
+    epoch_retire(storage_release, storage->allocator, storage, sizeof(tc_storage));
+}
+
+/// The record to publish the next storage of config in: the spare of the current record when no
+/// reader can hold it anymore, or a new one. NULL when it can't be allocated.
+internal tc_storage *storage_next(tc_config *config)
+{
+    tc_storage *current = config->storage;
+    if (current != NULL && current->spare != NULL)
+    {
+        for (int advances = 0; advances < 2; advances++)
+        {
+            if (atomic_load_acquire(&epoch_global) - current->spare_epoch >= 2) break;
+            epoch_try_advance();
+        }
+        if (atomic_load_acquire(&epoch_global) - current->spare_epoch >= 2)
+        {
+            tc_storage *spare = current->spare;
+            current->spare = NULL;
+            return spare;
+        }
+    }
+    return storage_alloc(config);
+}
+
+/// Fill storage with the storage fields of config and publish it, storage can be NULL to leave
+/// the config without a record. Return the previous record.
+internal tc_storage *storage_swap(tc_config *config, tc_storage *storage)
+{
+    tc_storage *previous = config->storage;
+    if (storage != NULL)
+    {
+        bool scratch_source = config->source != NULL && config->source == config->scratch.data;
+        storage->view = (tc_config) {
+            .buffer          = config->buffer,
+            .size            = config->size,
+            .index           = config->index,
+            .index_size      = config->index_size,
+            .flags           = config->flags,
+            .source          = config->source,
+            .source_capacity = scratch_source ? config->scratch.capacity : config->source_capacity,
+            .allocator       = storage->allocator,
+            .chunks          = config->chunks,
+            .chunk_count     = config->chunk_count,
+            .access_counts   = config->access_counts,
+            .access_capacity = config->access_capacity,
+        };
+        storage->load = atomic_increment(&storage_loads);
+    }
+    atomic_store_pointer_release((void **) &config->storage, storage);
+    return previous;
+}
+
+/// Publish storage (from storage_next) and keep the previous record as its spare. A spare that
+/// wasn't reused is retired, and without storage the previous record is retired too.
+internal void storage_publish(tc_config *config, tc_storage *storage)
+{
+    tc_storage *previous = storage_swap(config, storage);
+    if (previous == NULL) return;
+    if (storage == NULL)
+    {
+        storage_retire(previous);
+        return;
+    }
+
+    if (previous->spare != NULL)
+    {
+        epoch_retire(storage_release, previous->spare->allocator, previous->spare, sizeof(tc_storage));
+        previous->spare = NULL;
+    }
+    // Loaded after the record was unlinked, like the epoch of retired blocks.
+    storage->spare       = previous;
+    storage->spare_epoch = atomic_load_acquire(&epoch_global);
+}
+
+/// Publish the current storage of config, return false when the record couldn't be allocated.
+internal bool storage_reset(tc_config *config)
+{
+    tc_storage *storage = storage_next(config);
+    storage_publish(config, storage);
+    return storage != NULL;
+}
+
+/// The config to read the storage of config from, load is set to the number of its record (0
+/// without one) when it isn't NULL.
+internal tc_config *storage_view_load(tc_config *config, uint32_t *load)
+{
+    tc_storage *storage = atomic_load_pointer_acquire((void **) &config->storage);
+    if (load != NULL) *load = storage != NULL ? storage->load : 0;
+    return storage != NULL ? &storage->view : config;
+}
+
+internal tc_config *storage_view(tc_config *config)
+{
+    return storage_view_load(config, NULL);
+}
+
+//---------------------------------------------------------------------------
+// Growable storage
+//---------------------------------------------------------------------------
+
+/*
+    TC_GROW configs own their lines and index (TC_OWNED). The lines are stored in chunks of
+    TC_GROW_CHUNK_LINES slots, a new chunk is allocated when a line doesn't fit and chunks never
+    move, so the values returned by tc_get_value stay valid while the config grows. Only the
+    table of chunk pointers is reallocated. The index is rehashed into twice as many entries
+    whenever it would become more than half full.
+
+    The chunks and the chunk table are counted blocks, they start with a reference count so that
+    tc_snapshot can share them with the config, see "Snapshots".
+*/
+
+/// The chunk table has a power of two capacity, so it's known from the amount of chunks.
+internal size_t chunk_table_capacity(size_t chunk_count)
+{
+    if (chunk_count == 0) return 0;
+
+    size_t capacity = 1;
+    while (capacity < chunk_count) capacity *= 2;
+    return capacity;
+}
+
+#define COUNTED_HEADER_SIZE 16
+#define CHUNK_SIZE (TC_GROW_CHUNK_LINES * TC_LINE_TOTAL_SIZE)
+
+internal uint32_t *counted_references(void *data)
+{
+    return (uint32_t *) ((char *) data - COUNTED_HEADER_SIZE);
+}
+
+/// Allocate size bytes with a reference count of 1, the header keeps the data aligned.
+internal void *counted_alloc(const tc_allocator *allocator, size_t size)
+{
+    char *block = memory_alloc(allocator, COUNTED_HEADER_SIZE + size);
+    if (block == NULL) return NULL;
+
+    *(uint32_t *) block = 1;
+    return block + COUNTED_HEADER_SIZE;
+}
+
+internal void counted_free(const tc_allocator *allocator, void *data, size_t size)
+{
+    memory_free(allocator, (char *) data - COUNTED_HEADER_SIZE, COUNTED_HEADER_SIZE + size);
+}
+
+internal void counted_retain(void *data)
+{
+    atomic_increment(counted_references(data));
+}
+
+/// Drop a reference, return whether it was the last one.
+internal bool counted_drop(void *data)
+{
+    return atomic_decrement(counted_references(data)) == 0;
+}
+
+internal bool counted_is_shared(void *data)
+{
+    return atomic_load_acquire(counted_references(data)) > 1;
+}
+
+internal void chunk_release(const tc_allocator *allocator, void *chunk)
+{
+    if (counted_drop(chunk)) counted_free(allocator, chunk, CHUNK_SIZE);
+}
+
+/// Drop a reference to the chunk table, the last one releases its chunks.
+internal void chunk_table_release(const tc_allocator *allocator, void **chunks, size_t chunk_count)
+{
+    if (chunks == NULL || !counted_drop(chunks)) return;
+
+    for (size_t i = 0; i < chunk_count; i++)
+        chunk_release(allocator, chunks[i]);
+    counted_free(allocator, chunks, chunk_table_capacity(chunk_count) * sizeof(void *));
+}
+
+/// Retired references to the chunks and the chunk table, see "Epochs".
+internal void chunk_release_retired(const tc_allocator *allocator, void *chunk, size_t size)
+{
+    (void) size;
+    chunk_release(allocator, chunk);
+}
+
+internal void chunk_table_release_retired(const tc_allocator *allocator, void *chunks, size_t chunk_count)
+{
+    chunk_table_release(allocator, chunks, chunk_count);
+}
+
+/// Make room for the given amount of lines, only TC_GROW configs can go over TC_CONFIG_MAX_SIZE.
+internal bool lines_reserve(tc_config *config, size_t lines)
+{
+    if (!(config->flags & TC_GROW))
+    {
+        if (lines <= TC_CONFIG_MAX_SIZE) return true;
+        ERROR_REPORT("amount of lines exceeds TC_CONFIG_MAX_SIZE (%i)", TC_CONFIG_MAX_SIZE);
+        return false;
+    }
+
+    const tc_allocator *allocator = config_allocator(config);
+    while (config->chunk_count * TC_GROW_CHUNK_LINES < lines)
+    {
+        size_t table_capacity = chunk_table_capacity(config->chunk_count);
+        if (config->chunk_count == table_capacity)
+        {
+            // Loads never grow a table shared with snapshots, config_grow_prepare replaces it.
+            size_t grown = table_capacity > 0 ? table_capacity * 2 : 1;
+            void **chunks = counted_alloc(allocator, grown * sizeof(void *));
+            if (chunks == NULL) return false;
+            if (config->chunks != NULL)
+            {
+                memcpy(chunks, config->chunks, config->chunk_count * sizeof(void *));
+                counted_free(allocator, config->chunks, table_capacity * sizeof(void *));
+            }
+            config->chunks = chunks;
+        }
+
+        void *chunk = counted_alloc(allocator, CHUNK_SIZE);
+        if (chunk == NULL) return false;
+        config->chunks[config->chunk_count] = chunk;
+        config->chunk_count += 1;
+        config->flags |= TC_OWNED;
+    }
+    return true;
+}
+
+/*
+    The index and the source of a config are shared with its snapshots through a tc_shared record,
+    which is created by the first snapshot and released by the last of the config and its
+    snapshots. The config writes neither of them until it's loaded again, then it detaches from
+    the record and starts over with storage of its own. tc_optimize_layout is the exception, it
+    rewrites the index, so it gives the config a copy held by a new record whose parent keeps the
+    source.
+*/
+
+struct tc_shared {
+    uint32_t            references;
+    tc_index_entry     *index;
+    size_t              index_size;
+    char               *source;
+    size_t              source_capacity;
+    const tc_allocator *allocator;
+    tc_shared          *parent;
+};
+
+internal void shared_release(tc_shared *shared)
+{
+    while (shared != NULL && atomic_decrement(&shared->references) == 0)
+    {
+        tc_shared *parent = shared->parent;
+        memory_free(shared->allocator, shared->index, shared->index_size * sizeof(tc_index_entry));
+        memory_free(shared->allocator, shared->source, shared->source_capacity);
+        memory_free(shared->allocator, shared, sizeof(tc_shared));
+        shared = parent;
+    }
+}
+
+internal void shared_release_retired(const tc_allocator *allocator, void *shared, size_t size)
+{
+    (void) allocator;
+    (void) size;
+    shared_release(shared);
+}
+
+/// Leave the index and the source to the snapshots, the config no longer points to them. Return
+/// the reference of the config to the record.
+internal tc_shared *shared_forget(tc_config *config)
+{
+    for (tc_shared *shared = config->shared; shared != NULL; shared = shared->parent)
+    {
+        if (config->index == shared->index)
+        {
+            config->index      = NULL;
+            config->index_size = 0;
+        }
+        if (config->source == shared->source)
+        {
+            config->source          = NULL;
+            config->source_capacity = 0;
+        }
+    }
+    tc_shared *shared = config->shared;
+    config->shared = NULL;
+    return shared;
+}
+
+internal void shared_detach(tc_config *config)
+{
+    shared_release(shared_forget(config));
+}
+
+/// Give the config an index of its own before it's rewritten.
+internal bool index_unshare(tc_config *config)
+{
+    tc_shared *shared = config->shared;
+    if (shared == NULL || atomic_load_acquire(&shared->references) == 1) return true;
+
+    const tc_allocator *allocator = config_allocator(config);
+    tc_shared *copy = memory_alloc(allocator, sizeof(tc_shared));
+    tc_index_entry *index = memory_alloc(allocator, config->index_size * sizeof(tc_index_entry));
+    if (copy == NULL || index == NULL)
+    {
+        memory_free(allocator, copy, sizeof(tc_shared));
+        memory_free(allocator, index, config->index_size * sizeof(tc_index_entry));
+        return false;
+    }
+
+    // The reference of the config to the previous record moves to the copy.
+    memcpy(index, config->index, config->index_size * sizeof(tc_index_entry));
+    *copy = (tc_shared) {
+        .references = 1,
+        .index      = index,
+        .index_size = config->index_size,
+        .allocator  = allocator,
+        .parent     = shared,
+    };
+    config->index  = index;
+    config->shared = copy;
+    return true;
+}
+
+/// Give the config its own copy of the chunk of the line before it's written, the chunk table is
+/// copied first when a snapshot shares it. Only the chunks that are written get copied. Readers
+/// may still be in the previous chunk and table, their references are retired.
+internal bool chunk_unshare(tc_config *config, size_t line)
+{
+    if (config->shared == NULL || config->chunks == NULL) return true;
+
+    const tc_allocator *allocator = config_allocator(config);
+    if (counted_is_shared(config->chunks))
+    {
+        // Readers find the chunk table through the record, which points to the previous one.
+        size_t table_size = chunk_table_capacity(config->chunk_count) * sizeof(void *);
+        tc_storage *storage = storage_next(config);
+        void **chunks = counted_alloc(allocator, table_size);
+        if (storage == NULL || chunks == NULL)
+        {
+            storage_free(storage);
+            if (chunks != NULL) counted_free(allocator, chunks, table_size);
+            return false;
+        }
+
+        memcpy(chunks, config->chunks, config->chunk_count * sizeof(void *));
+        for (size_t i = 0; i < config->chunk_count; i++)
+            counted_retain(chunks[i]);
+        epoch_retire(chunk_table_release_retired, allocator, config->chunks, config->chunk_count);
+        config->chunks = chunks;
+        storage_publish(config, storage);
+    }
+
+    void **chunk = &config->chunks[line / TC_GROW_CHUNK_LINES];
+    if (counted_is_shared(*chunk))
+    {
+        void *copy = counted_alloc(allocator, CHUNK_SIZE);
+        if (copy == NULL) return false;
+
+        memcpy(copy, *chunk, CHUNK_SIZE);
+        epoch_retire(chunk_release_retired, allocator, *chunk, 0);
+        *chunk = copy;
+    }
+    return true;
+}
+
+/// Whether the chunk table or any of the chunks is shared with a snapshot.
+internal bool chunks_shared(tc_config *config)
+{
+    if (counted_is_shared(config->chunks)) return true;
+    for (size_t i = 0; i < config->chunk_count; i++)
+        if (counted_is_shared(config->chunks[i])) return true;
+    return false;
+}
+
+/// Release the lines and index owned by the config.
+internal void config_owned_free(tc_config *config)
+{
+    shared_detach(config);
+    if (!(config->flags & TC_OWNED)) return;
+
+    const tc_allocator *allocator = config_allocator(config);
+    if (config->chunks != NULL)
+    {
+        chunk_table_release(allocator, config->chunks, config->chunk_count);
+    }
+    else
+    {
+        // The line buffer always has half as many lines as index entries.
+        memory_free(allocator, config->buffer, config->index_size / 2 * TC_LINE_TOTAL_SIZE);
+    }
+    memory_free(allocator, config->index, config->index_size * sizeof(tc_index_entry));
+
+    config->buffer      = NULL;
+    config->chunks      = NULL;
+    config->chunk_count = 0;
+    config->index       = NULL;
+    config->index_size  = 0;
+    config->flags      &= ~TC_OWNED;
+}
+
+/// Empty a TC_GROW config for a new load, its chunks and index are kept to be reused unless
+/// snapshots share them.
+internal void config_grow_prepare(tc_config *config)
+{
+    shared_detach(config);
+    if (config->chunks != NULL && chunks_shared(config))
+    {
+        chunk_table_release(config_allocator(config), config->chunks, config->chunk_count);
+        config->chunks      = NULL;
+        config->chunk_count = 0;
+    }
+
+    if (config->chunks == NULL)
+    {
+        // Storage of a load without TC_GROW, which isn't always owned by the config.
+        config_owned_free(config);
+        config->buffer     = NULL;
+        config->index      = NULL;
+        config->index_size = 0;
+    }
+    else if (config->index != NULL)
+    {
+        memset(config->index, 0, config->index_size * sizeof(tc_index_entry));
+    }
+    config->size = 0;
+}
+
+//---------------------------------------------------------------------------
+// Source lines
+//---------------------------------------------------------------------------
+
+/// Stored in place of the line text while a TC_LAZY or TC_VIEW line lives inside of
+/// config->source, the positions point inside of it. value_end is the last value character,
+/// before trimming for TC_LAZY and after trimming for TC_VIEW.
+typedef struct {
+    uint32_t key;
+    uint32_t key_length;
+    uint32_t value;
+    uint32_t value_end;
+} source_line;
+
+/// Source lines have a header of 0, a line stored in its slot always has an offset of at least 2.
+internal bool line_in_source(tc_config *config, size_t line)
+{
+    return line_offset_get(config, line) == 0;
+}
+
+/// Capacity of the buffer that config->source points to.
+internal size_t source_capacity(tc_config *config)
+{
+    if (config->source == config->scratch.data) return config->scratch.capacity;
+    return config->source_capacity;
+}
+
+internal source_line source_line_read(tc_config *config, size_t line)
+{
+    source_line record;
+    memcpy(&record, header_read(line_get(config, line)), sizeof(record));
+
+    // tc_set_value can be copying a line over its record on another thread, a torn record is
+    // kept inside of the source so that tc_get_value_copy can read it and retry.
+    size_t capacity = source_capacity(config);
+    if ((size_t) record.key + record.key_length > capacity || record.value_end >= capacity
+        || record.value > record.value_end)
+    {
+        record = (source_line) {0};
+    }
+    return record;
+}
+
+/// Return the key of a line, in its slot or not, alongside its length.
+internal const char *line_key(tc_config *config, size_t line, size_t *key_length)
+{
+    if (line_in_source(config, line))
+    {
+        source_line record = source_line_read(config, line);
+        *key_length = record.key_length;
+        return &config->source[record.key];
+    }
+
+    *key_length = line_offset_get(config, line) - 1;
+    return header_read(line_get(config, line));
+}
+
+/// Copy the key of a source line and the given value into its slot.
+internal void line_materialize(
+    tc_config *config,
+    size_t line,
+    const char *value,
+    size_t value_start,
+    size_t value_end
+) {
+    source_line record = source_line_read(config, line);
+    void *location = line_get(config, line);
+    char *key_start = header_read(location);
+
+    string_copy_slice(config->source, record.key, record.key + record.key_length - 1, key_start);
+    key_start[record.key_length] = '=';
+    string_copy_slice_null(value, value_start, value_end, &key_start[record.key_length + 1]);
+
+    header_write(location, record.key_length + 1, value_end - value_start + 1, header_hash(location));
+}
+
+/// Return the value of a line alongside its length. Lazy lines are materialized first and view
+/// lines point inside of config->source.
+internal char *line_value(tc_config *config, size_t line, size_t *value_length)
+{
+    if (line_in_source(config, line))
+    {
+        source_line record = source_line_read(config, line);
+        if (config->flags & TC_VIEW)
+        {
+            *value_length = record.value_end - record.value + 1;
+            return &config->source[record.value];
+        }
+
+        size_t trim_end_position = string_trim_end(config->source, record.value_end);
+        line_materialize(config, line, config->source, record.value, trim_end_position);
+    }
+
+    *value_length = line_value_length_get(config, line);
+    char *key_start = header_read(line_get(config, line));
+    return &key_start[line_offset_get(config, line)];
+}
+
+/// Return the value of a line alongside its length without ever writing to the config, lazy
+/// lines are read from config->source and aren't null terminated.
+internal const char *line_value_peek(tc_config *config, size_t line, size_t *value_length)
+{
+    if (line_in_source(config, line))
+    {
+        source_line record = source_line_read(config, line);
+        size_t value_end = record.value_end;
+        if (!(config->flags & TC_VIEW)) value_end = string_trim_end(config->source, value_end);
+
+        bool empty    = value_end == SIZE_MAX || value_end < record.value;
+        *value_length = empty ? 0 : value_end - record.value + 1;
+        return &config->source[record.value];
+    }
+
+    size_t offset = line_offset_get(config, line);
+    *value_length = line_value_length_get(config, line);
+    // A header that tc_set_value is writing on another thread can be torn.
+    if (offset + *value_length >= TC_LINE_MAX_SIZE)
+    {
+        offset        = 0;
+        *value_length = 0;
+    }
+    return &header_read(line_get(config, line))[offset];
+}
+
+/// Write a new value to the line, source lines are moved into their slot with it. Writers call it
+/// under config->sequence. False is returned when the chunk shared with a snapshot can't be copied.
+internal bool line_value_write(tc_config *config, size_t line, const char *value, size_t value_length)
+{
+    if (!chunk_unshare(config, line)) return false;
+
+    void *location = line_get(config, line);
+    if (line_in_source(config, line))
+    {
+        line_materialize(config, line, value, 0, value_length - 1);
+        return true;
+    }
+
+    size_t offset = line_offset_get(config, line);
+    string_copy_slice_null(value, 0, value_length - 1, &header_read(location)[offset]);
+    header_write(location, offset, value_length, header_hash(location));
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Index
+//---------------------------------------------------------------------------
+
+#define LINE_NOT_FOUND SIZE_MAX
+
+/// Rehash the index of a TC_GROW config into a bigger one when the given amount of lines would
+/// fill more than half of it. Entries keep the hash of their key, so they are only moved.
+internal bool index_reserve(tc_config *config, size_t lines)
+{
+    if (!(config->flags & TC_GROW) || lines * 2 <= config->index_size) return true;
+
+    size_t index_size = config->index_size > 0 ? config->index_size * 2 : TC_GROW_CHUNK_LINES * 2;
+    while (index_size < lines * 2) index_size *= 2;
+
+    const tc_allocator *allocator = config_allocator(config);
+    tc_index_entry *index = memory_calloc(allocator, index_size, sizeof(tc_index_entry));
+    if (index == NULL) return false;
+
+    for (size_t i = 0; i < config->index_size; i++)
+    {
+        tc_index_entry entry = config->index[i];
+        if (entry.line == 0) continue;
+
+        size_t position = entry.hash % index_size;
+        while (index[position].line != 0) position = (position + 1) % index_size;
+        index[position] = entry;
+    }
+
+    memory_free(allocator, config->index, config->index_size * sizeof(tc_index_entry));
+    config->index      = index;
+    config->index_size = index_size;
+    config->flags     |= TC_OWNED;
+    return true;
+}
+
+/// Add the line to the index with the hash of its key, unless the key is already indexed by a
+/// previous line. TC_GROW configs grow their index first.
+internal bool index_insert_hash(tc_config *config, size_t line, uint32_t hash)
+{
+    if (!index_reserve(config, line + 1)) return false;
+    assert(config->index_size > line);
+    size_t key_length;
+    const char *key_start = line_key(config, line, &key_length);
+
+    size_t i = hash % config->index_size;
+    for (;;)
+    {
+        tc_index_entry *entry = &config->index[i];
+        if (entry->line == 0)
+        {
+            entry->hash = hash;
+            entry->line = (uint32_t) (line + 1);
+            return true;
+        }
+
+        if (entry->hash == hash)
+        {
+            size_t indexed_length;
+            const char *indexed_key = line_key(config, entry->line - 1, &indexed_length);
+            if (indexed_length == key_length && key_compare(key_start, key_length, indexed_key))
+                return true;
+        }
+
+        i = (i + 1) % config->index_size;
+    }
+}
+
+/// Find the line that stores the key with key_length characters and the given hash, or
+/// LINE_NOT_FOUND when the key doesn't exist. Configs without an index are scanned line by line.
+internal size_t index_find_hash(tc_config *config, const char *key, size_t key_length, uint32_t hash)
+{
+    if (config->index == NULL)
+    {
+        for (size_t i = 0; i < config->size; i += 1)
+        {
+            if (!line_hash_match(config, i, hash)) continue;
+            size_t line_key_length;
+            const char *key_start = line_key(config, i, &line_key_length);
+            if (line_key_length == key_length && key_compare(key, key_length, key_start))
+                return i;
+        }
+        return LINE_NOT_FOUND;
+    }
+
+    size_t i = hash % config->index_size;
+    for (;;)
+    {
+        tc_index_entry *entry = &config->index[i];
+        if (entry->line == 0) return LINE_NOT_FOUND;
+
+        if (entry->hash == hash)
+        {
+            size_t line_key_length;
+            const char *key_start = line_key(config, entry->line - 1, &line_key_length);
+            if (line_key_length == key_length && key_compare(key, key_length, key_start))
+                return entry->line - 1;
+        }
+
+        i = (i + 1) % config->index_size;
+    }
+}
+
+/// Find the line that stores the null terminated key, or LINE_NOT_FOUND.
+internal size_t index_find(tc_config *config, const char *key)
+{
+    size_t key_length;
+    uint32_t hash = key_hash_null(key, &key_length);
+    return index_find_hash(config, key, key_length, hash);
+}
+
+//---------------------------------------------------------------------------
+// Layout
+//---------------------------------------------------------------------------
+
+/*
+    TC_PROFILE configs count the reads of each line in config->access_counts. tc_optimize_layout
+    moves the most read lines to the first slots, so they share the first cache lines (and the
+    first chunk of TC_GROW configs) and are the first ones compared when the lines are scanned.
+    Index entries only keep the position of their line, so moving the lines rewrites those
+    positions and nothing is rehashed. A profile written by tc_export_profile and set on
+    config->profile gives the same order to the next loads, right after parsing.
+*/
+
+/// Line and its rank in the new layout, lines with the same rank keep their order.
+typedef struct {
+    size_t rank;
+    size_t line;
+} layout_entry;
+
+internal int layout_entry_compare(const void *a, const void *b)
+{
+    const layout_entry *first  = a;
+    const layout_entry *second = b;
+    if (first->rank != second->rank) return first->rank < second->rank ? -1 : 1;
+    if (first->line != second->line) return first->line < second->line ? -1 : 1;
+    return 0;
+}
+
+/// Count a read of the line when the config has access counts.
+internal void line_count_access(tc_config *config, size_t line)
+{
+    if (config->access_counts != NULL && line < config->access_capacity)
+        atomic_increment(&config->access_counts[line]);
+}
+
+/// Hash the key of the line, return false when a previous line has the same key, as only the
+/// indexed line of a key is ever read.
+internal bool line_indexed_hash(tc_config *config, size_t line, uint32_t *hash)
+{
+    size_t key_length;
+    const char *key = line_key(config, line, &key_length);
+    *hash = key_hash(key, key_length);
+    return index_find_hash(config, key, key_length, *hash) == line;
+}
+
+/// Rank the lines by their access count, the most read first.
+internal layout_entry *layout_by_access(tc_config *config)
+{
+    layout_entry *entries = memory_alloc(global_allocator, config->size * sizeof(layout_entry));
+    if (entries == NULL) return NULL;
+
+    for (size_t i = 0; i < config->size; i++)
+    {
+        uint32_t count = i < config->access_capacity ? config->access_counts[i] : 0;
+        entries[i] = (layout_entry) { .rank = UINT32_MAX - count, .line = i };
+    }
+    qsort(entries, config->size, sizeof(layout_entry), layout_entry_compare);
+    return entries;
+}
+
+/// Move the per line values of a capacity long array to the order of entries, through
+/// temporary, which holds size values.
+internal void layout_move_values(
+    uint32_t *values,
+    size_t capacity,
+    const layout_entry *entries,
+    size_t size,
+    uint32_t *temporary
+) {
+    if (values == NULL) return;
+
+    for (size_t i = 0; i < size; i++)
+        temporary[i] = entries[i].line < capacity ? values[entries[i].line] : 0;
+    for (size_t i = 0; i < size && i < capacity; i++)
+        values[i] = temporary[i];
+}
+
+/// Move every line to the slot given by the order of entries, their per line values and index
+/// entries follow them.
+internal bool layout_apply(tc_config *config, const layout_entry *entries)
+{
+    size_t size         = config->size;
+    size_t slots_size   = size * TC_LINE_TOTAL_SIZE;
+    char *slots         = memory_alloc(global_allocator, slots_size);
+    size_t *positions   = memory_alloc(global_allocator, size * sizeof(size_t));
+    uint32_t *temporary = memory_alloc(global_allocator, size * sizeof(uint32_t));
+    bool success = slots != NULL && positions != NULL && temporary != NULL && index_unshare(config);
+    for (size_t line = 0; line < size && success; line += TC_GROW_CHUNK_LINES)
+        success = chunk_unshare(config, line);
+
+    if (success)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            size_t line = entries[i].line;
+            memcpy(slots + (TC_LINE_TOTAL_SIZE * i), line_get(config, line), TC_LINE_TOTAL_SIZE);
+            positions[line] = i;
+        }
+        for (size_t i = 0; i < size; i++)
+            memcpy(line_get(config, i), slots + (TC_LINE_TOTAL_SIZE * i), TC_LINE_TOTAL_SIZE);
+
+        layout_move_values(config->access_counts, config->access_capacity, entries, size, temporary);
+        layout_move_values(
+            config->line_generations, config->line_generations_capacity, entries, size, temporary
+        );
+
+        for (size_t i = 0; config->index != NULL && i < config->index_size; i++)
+        {
+            tc_index_entry *entry = &config->index[i];
+            if (entry->line != 0) entry->line = (uint32_t) (positions[entry->line - 1] + 1);
+        }
+    }
+
+    memory_free(global_allocator, slots, slots_size);
+    memory_free(global_allocator, positions, size * sizeof(size_t));
+    memory_free(global_allocator, temporary, size * sizeof(uint32_t));
+    return success;
+}
+
+/// Reset the access counts of a config that was just loaded.
+internal bool access_counts_reset(tc_config *config)
+{
+    size_t size = config->size;
+    const tc_allocator *allocator = config_allocator(config);
+    if ((config->flags & TC_PROFILE) && config->access_capacity < size)
+    {
+        memory_free(allocator, config->access_counts, config->access_capacity * sizeof(uint32_t));
+        config->access_counts   = memory_calloc(allocator, size, sizeof(uint32_t));
+        config->access_capacity = config->access_counts != NULL ? size : 0;
+        if (config->access_counts == NULL) return false;
+    }
+    else if (config->access_counts != NULL)
+    {
+        memset(config->access_counts, 0, config->access_capacity * sizeof(uint32_t));
+    }
+    return true;
+}
+
+/// Reset the access counts of a config that was just loaded, and give its lines the order of
+/// config->profile.
+internal bool layout_loaded(tc_config *config)
+{
+    if (!access_counts_reset(config)) return false;
+
+    size_t size = config->size;
+    if (config->profile.count == 0 || config->index == NULL || size < 2) return true;
+
+    layout_entry *entries = memory_alloc(global_allocator, size * sizeof(layout_entry));
+    if (entries == NULL) return false;
+    for (size_t i = 0; i < size; i++)
+        entries[i] = (layout_entry) { .rank = SIZE_MAX, .line = i };
+
+    // Only the hashes are known, the first indexed line with each hash takes its rank.
+    for (size_t rank = 0; rank < config->profile.count; rank++)
+    {
+        uint32_t hash = config->profile.hashes[rank];
+        size_t i = hash % config->index_size;
+        while (config->index[i].line != 0)
+        {
+            layout_entry *entry = &entries[config->index[i].line - 1];
+            if (config->index[i].hash == hash && entry->rank == SIZE_MAX)
+            {
+                entry->rank = rank;
+                break;
+            }
+            i = (i + 1) % config->index_size;
+        }
+    }
+
+    qsort(entries, size, sizeof(layout_entry), layout_entry_compare);
+    bool success = layout_apply(config, entries);
+    memory_free(global_allocator, entries, size * sizeof(layout_entry));
+    return success;
+}
+
+//---------------------------------------------------------------------------
+// Lexer
+//---------------------------------------------------------------------------
+
+/*
+    The lexer is a DFA driven by two constant tables, so it doesn't depend on the locale (unlike
+    isalpha and isdigit) and the hot loop is one class lookup and one transition lookup per byte.
+
+    char_class maps every byte to a character class, and transitions maps a state and a class to
+    the next state alongside the actions to run on that transition. Actions only happen at token
+    boundaries, every other byte goes through the loop without taking a branch.
+*/
+
+enum {
+    CLASS_SPACE,      // ' ' '\t'
+    CLASS_CR,         // '\r'
+    CLASS_LF,         // '\n'
+    CLASS_HASH,       // '#'
+    CLASS_EQUALS,     // '='
+    CLASS_ALPHA,      // a-z A-Z
+    CLASS_DIGIT,      // 0-9
+    CLASS_UNDERSCORE, // '_'
+    CLASS_SIGN,       // '-' '.'
+    CLASS_NULL,       // '\0'
+    CLASS_OTHER,
+    CLASS_COUNT,
+};
+
+#define S CLASS_SPACE
+#define R CLASS_CR
+#define L CLASS_LF
+#define H CLASS_HASH
+#define E CLASS_EQUALS
+#define A CLASS_ALPHA
+#define D CLASS_DIGIT
+#define U CLASS_UNDERSCORE
+#define M CLASS_SIGN
+#define N CLASS_NULL
+#define O CLASS_OTHER
+
+internal const unsigned char char_class[256] = {
+    N, O, O, O, O, O, O, O, O, S, L, O, O, R, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    S, O, O, H, O, O, O, O, O, O, O, O, O, M, M, O,
+    D, D, D, D, D, D, D, D, D, D, O, O, O, E, O, O,
+    O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, U,
+    O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+};
+
+#undef S
+#undef R
+#undef L
+#undef H
+#undef E
+#undef A
+#undef D
+#undef U
+#undef M
+#undef N
+#undef O
+
+enum {
+    STATE_LINE,          // Waiting for a key.
+    STATE_KEY_ALPHA,     // Inside of a key started by a letter: letters and '_'.
+    STATE_KEY_DIGIT,     // Inside of a key started by a digit: digits only.
+    STATE_AFTER_KEY,     // A key was read, waiting for '='.
+    STATE_BEFORE_VALUE,  // After '=', waiting for the first value character.
+    STATE_VALUE,         // Inside of a value, until the end of the line or a comment.
+    STATE_COMMENT_LINE,  // Comments return to the state they started from.
+    STATE_COMMENT_KEY,
+    STATE_COMMENT_VALUE,
+    STATE_ERROR,
+    STATE_COUNT,
+};
+
+// Actions are stored above the next state on each transition.
+#define ACTION_KEY_START   (1 << 8)
+#define ACTION_KEY_END     (1 << 9)
+#define ACTION_VALUE_START (1 << 10)
+#define ACTION_VALUE_END   (1 << 11)
+#define ACTION_KEY_ERROR   (1 << 12)
+#define ACTION_VALUE_ERROR (1 << 13)
+#define ACTION_NO_KEY      (1 << 14)
+#define ACTION_MASK        0xff00
+#define STATE_MASK         0x00ff
+
+// Short names to keep the transitions table readable.
+#define LN STATE_LINE
+#define KA STATE_KEY_ALPHA
+#define KD STATE_KEY_DIGIT
+#define AK STATE_AFTER_KEY
+#define BV STATE_BEFORE_VALUE
+#define VA STATE_VALUE
+#define CL STATE_COMMENT_LINE
+#define CK STATE_COMMENT_KEY
+#define CV STATE_COMMENT_VALUE
+#define ER STATE_ERROR
+#define KS(state) (state | ACTION_KEY_START)
+#define KE(state) (state | ACTION_KEY_END)
+#define KR(state) (state | ACTION_KEY_END | ACTION_KEY_START)
+#define VS(state) (state | ACTION_VALUE_START)
+#define VE(state) (state | ACTION_VALUE_END)
+#define KX        (STATE_ERROR | ACTION_KEY_ERROR)
+#define VX        (STATE_ERROR | ACTION_VALUE_ERROR)
+#define NK        (STATE_ERROR | ACTION_NO_KEY)
+
+internal const uint16_t transitions[STATE_COUNT][CLASS_COUNT] = {
+    //       SPACE   CR      LF      HASH    EQUALS  ALPHA   DIGIT   _       - .     NULL    OTHER
+    [LN] = { LN,     LN,     LN,     CL,     NK,     KS(KA), KS(KD), KX,     KX,     KX,     KX },
+    [KA] = { KE(AK), KE(AK), KE(AK), KE(CK), KE(BV), KA,     KR(KD), KA,     KX,     KX,     KX },
+    [KD] = { KE(AK), KE(AK), KE(AK), KE(CK), KE(BV), KR(KA), KD,     KX,     KX,     KX,     KX },
+    [AK] = { AK,     AK,     AK,     CK,     BV,     KS(KA), KS(KD), KX,     KX,     KX,     KX },
+    [BV] = { BV,     BV,     BV,     CV,     BV,     VS(VA), VS(VA), VX,     VS(VA), VX,     VX },
+    [VA] = { VA,     VE(LN), VE(LN), VE(CL), VA,     VA,     VA,     VA,     VA,     VX,     VA },
+    [CL] = { CL,     CL,     LN,     CL,     CL,     CL,     CL,     CL,     CL,     CL,     CL },
+    [CK] = { CK,     CK,     AK,     CK,     CK,     CK,     CK,     CK,     CK,     CK,     CK },
+    [CV] = { CV,     CV,     BV,     CV,     CV,     CV,     CV,     CV,     CV,     CV,     CV },
+    [ER] = { ER,     ER,     ER,     ER,     ER,     ER,     ER,     ER,     ER,     ER,     ER },
+};
+
+#undef LN
+#undef KA
+#undef KD
+#undef AK
+#undef BV
+#undef VA
+#undef CL
+#undef CK
+#undef CV
+#undef ER
+#undef KS
+#undef KE
+#undef KR
+#undef VS
+#undef VE
+#undef KX
+#undef VX
+#undef NK
+
+/// Position of the key and of the value being read by the lexer.
+typedef struct {
+    size_t    current_line;
+    size_t    key_pos;
+    size_t    key_size;
+    size_t    value_pos;
+    bool      view;
+    bool      in_source;
+    // Parallel lexing (see "Parallel parsing") only counts lines on its first pass, and on its
+    // second pass it stores the key hashes in hashes instead of inserting them in the index. The
+    // lines are reserved before the second pass, lines from reserved_lines on fail the chunk
+    // instead of growing the storage under the other threads.
+    bool      count_only;
+    uint32_t *hashes;
+    size_t    reserved_lines;
+} lexer_state;
+
+/// Store the key that ends just before end into the slot of the current line.
+internal bool lexer_key(tc_config *config, lexer_state *lexer, const char *file_buffer, size_t end)
+{
+    // key_size is the position of the last key character, relative to key_pos.
+    lexer->key_size = end - lexer->key_pos - 1;
+    if (lexer->count_only) return true;
+
+    if (lexer->reserved_lines > 0 ? lexer->current_line >= lexer->reserved_lines
+        : !lines_reserve(config, lexer->current_line + 1))
+        return false;
+
+    if (!lexer->view && lexer->key_size >= TC_LINE_MAX_SIZE)
+    {
+        ERROR_REPORT(
+            "key at line %zi overflows TC_LINE_MAX_SIZE (%i)",
+            lexer->current_line,
+            TC_LINE_MAX_SIZE
+        );
+        return false;
+    }
+
+    // Lazy and view lines keep the key inside of the source, see source_line.
+    if (lexer->in_source) return true;
+
+    void *current_location = line_get(config, lexer->current_line);
+    // + 2 to land correctly on the start of the value, just after the = sign.
+    header_write(current_location, lexer->key_size + 2, 0, 0);
+    assert(header_offset(current_location) == lexer->key_size + 2);
+
+    char *key = header_read(current_location);
+    string_copy_slice(file_buffer, lexer->key_pos, end - 1, key);
+    key[lexer->key_size + 1] = '=';
+    return true;
+}
+
+/// Store the value that ends just before end and complete the current line.
+internal bool lexer_value(tc_config *config, lexer_state *lexer, char *file_buffer, size_t end)
+{
+    if (lexer->count_only)
+    {
+        lexer->current_line += 1;
+        return true;
+    }
+
+    size_t start_pos  = lexer->value_pos;
+    size_t last_pos   = end - 1;
+    size_t key_size   = lexer->key_size;
+    size_t value_size = last_pos - start_pos;
+
+    // +2 for '=' and '\0'
+    if (!lexer->view && (value_size + key_size + 2) >= TC_LINE_MAX_SIZE)
+    {
+        ERROR_REPORT("value at line %zi overflows default TC_LINE_MAX_SIZE (%i)",
+            lexer->current_line,
+            TC_LINE_MAX_SIZE
+        );
+        return false;
+    }
+
+    // The key is hashed once, for the header and for the index.
+    uint32_t hash = key_hash(&file_buffer[lexer->key_pos], key_size + 1);
+    void *current_location = line_get(config, lexer->current_line);
+    if (lexer->in_source)
+    {
+        source_line record = {
+            .key        = (uint32_t) lexer->key_pos,
+            .key_length = (uint32_t) (key_size + 1),
+            .value      = (uint32_t) start_pos,
+            .value_end  = (uint32_t) (lexer->view ? string_trim_end(file_buffer, last_pos) : last_pos),
+        };
+        header_write(current_location, 0, 0, TC_HEADER_HASH(hash));
+        memcpy(header_read(current_location), &record, sizeof(record));
+    }
+    else
+    {
+        char *key_start   = header_read(current_location);
+        char *value_start = &key_start[key_size + 2];
+        size_t trim_end_position = string_trim_end(file_buffer, last_pos);
+        string_copy_slice_null(
+            file_buffer,
+            start_pos,
+            trim_end_position,
+            value_start
+        );
+        header_write(
+            current_location, key_size + 2, trim_end_position - start_pos + 1, TC_HEADER_HASH(hash)
+        );
+    }
+
+    if (lexer->hashes != NULL)
+    {
+        lexer->hashes[lexer->current_line] = hash;
+    }
+    else
+    {
+        if (!index_insert_hash(config, lexer->current_line, hash)) return false;
+        config->size += 1;
+    }
+
+    lexer->current_line += 1;
+    return true;
+}
+
+/// Run the lexer over file_buffer from begin to end starting at state, and return the state it
+/// ends on (STATE_ERROR on failure). Lines are stored starting from lexer->current_line.
+internal unsigned int lexer_run(
+    tc_config *config,
+    lexer_state *lexer,
+    char *file_buffer,
+    size_t begin,
+    size_t end,
+    unsigned int state
+) {
+    for (size_t pos = begin; pos < end; pos++)
+    {
+        unsigned char c = (unsigned char) file_buffer[pos];
+        uint16_t transition = transitions[state][char_class[c]];
+        state = transition & STATE_MASK;
+
+        if (!(transition & ACTION_MASK)) continue;
+
+        // The end of a token is handled before the start of the next one.
+        if ((transition & ACTION_KEY_END) && !lexer_key(config, lexer, file_buffer, pos))
+            return STATE_ERROR;
+        if ((transition & ACTION_VALUE_END) && !lexer_value(config, lexer, file_buffer, pos))
+            return STATE_ERROR;
+        if (transition & ACTION_KEY_START)
+            lexer->key_pos = pos;
+        if (transition & ACTION_VALUE_START)
+            lexer->value_pos = pos;
+
+        if (lexer->count_only && state == STATE_ERROR) return STATE_ERROR;
+
+        if (transition & ACTION_KEY_ERROR)
+        {
+            ERROR_REPORT("key at line %zi has an illegal character: %c", lexer->current_line, c);
+            return STATE_ERROR;
+        }
+        if (transition & ACTION_VALUE_ERROR)
+        {
+            // Printed as a number, the character can be a null byte inside of the value.
+            ERROR_REPORT("value at line %zi has an illegal character: 0x%02x", lexer->current_line, c);
+            return STATE_ERROR;
+        }
+        if (transition & ACTION_NO_KEY)
+        {
+            ERROR_REPORT("value at line %zi doesn't have a key", lexer->current_line);
+            return STATE_ERROR;
+        }
+    }
+
+    return state;
+}
+
+//---------------------------------------------------------------------------
+// Threads
+//---------------------------------------------------------------------------
+
+#ifndef TC_PARALLEL_THREADS
+#define TC_PARALLEL_THREADS 0
+#endif
+
+#ifndef TC_PARALLEL_MAX_THREADS
+#define TC_PARALLEL_MAX_THREADS 64
+#endif
+
+/// Threads used by parallel work, TC_PARALLEL_THREADS or the amount of online processors.
+internal size_t thread_count(void)
+{
+    size_t threads = TC_PARALLEL_THREADS;
+#if defined(_SC_NPROCESSORS_ONLN)
+    if (threads == 0)
+    {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? (size_t) processors : 1;
+    }
+#endif
+    if (threads == 0) threads = 1;
+    if (threads > TC_PARALLEL_MAX_THREADS) threads = TC_PARALLEL_MAX_THREADS;
+    return threads;
+}
+
+typedef int (*thread_function)(void *);
+
+/// Run function once for each of the count arguments (each argument_size bytes apart) on its own
+/// thread, the first one runs on the calling thread. Without C11 threads everything runs here.
+internal void threads_spawn(thread_function function, void *arguments, size_t argument_size, size_t count)
+{
+    char *argument = arguments;
+    size_t started = 1;
+#ifndef __STDC_NO_THREADS__
+    thrd_t threads[TC_PARALLEL_MAX_THREADS];
+    assert(count <= TC_PARALLEL_MAX_THREADS);
+    for (; started < count; started++)
+    {
+        if (thrd_create(&threads[started], function, argument + argument_size * started) != thrd_success)
+            break;
+    }
+#endif
+
+    if (count > 0) function(argument);
+
+#ifndef __STDC_NO_THREADS__
+    for (size_t i = 1; i < started; i++)
+        thrd_join(threads[i], NULL);
+#endif
+
+    // Arguments without a thread run here.
+    for (size_t i = started; i < count; i++)
+        function(argument + argument_size * i);
+}
+
+/*
+    Parallel work runs on a pool of worker threads that is started on first use and kept for the
+    life of the process, so loads don't create and join threads every time. A run hands its
+    arguments to the workers and the calling thread, each one takes the next argument left. Only
+    one run uses the pool at a time: callers that find it busy (another thread loading at the same
+    time, or a worker loading a TC_PARALLEL file of a batch) start threads of their own instead.
+*/
+
+#ifndef __STDC_NO_THREADS__
+
+typedef struct {
+    mtx_t            lock;
+    cnd_t            work; // broadcast when a run starts
+    cnd_t            done; // signaled when the last argument of a run returns
+    bool             ready;
+    size_t           workers;
+    thread_function  function;
+    char            *arguments;
+    size_t           argument_size;
+    size_t           count;
+    size_t           next;
+    size_t           finished;
+} thread_pool;
+
+internal thread_pool pool;
+internal once_flag   pool_once = ONCE_FLAG_INIT;
+internal uint32_t    pool_busy = 0;
+
+internal void pool_init(void)
+{
+    pool.ready = mtx_init(&pool.lock, mtx_plain) == thrd_success
+        && cnd_init(&pool.work) == thrd_success
+        && cnd_init(&pool.done) == thrd_success;
+}
+
+/// Run the arguments left in the current run, with pool.lock held.
+internal void pool_drain(void)
+{
+    while (pool.next < pool.count)
+    {
+        thread_function function = pool.function;
+        char *argument = pool.arguments + pool.argument_size * pool.next;
+        pool.next += 1;
+
+        mtx_unlock(&pool.lock);
+        function(argument);
+        mtx_lock(&pool.lock);
+
+        pool.finished += 1;
+        if (pool.finished == pool.count) cnd_signal(&pool.done);
+    }
+}
+
+internal int pool_worker(void *unused)
+{
+    (void) unused;
+    mtx_lock(&pool.lock);
+    for (;;)
+    {
+        pool_drain();
+        cnd_wait(&pool.work, &pool.lock);
+    }
+    return 0;
+}
+
+/// Run the arguments on the pool, return false when it's busy or can't be used.
+internal bool pool_run(thread_function function, void *arguments, size_t argument_size, size_t count)
+{
+    call_once(&pool_once, pool_init);
+    if (!pool.ready || !atomic_compare_exchange(&pool_busy, 0, 1)) return false;
+
+    mtx_lock(&pool.lock);
+    // Workers are only added, up to one less than the biggest run. The calling thread takes
+    // the arguments of the workers that couldn't be started.
+    while (pool.workers + 1 < count)
+    {
+        thrd_t thread;
+        if (thrd_create(&thread, pool_worker, NULL) != thrd_success) break;
+        thrd_detach(thread);
+        pool.workers += 1;
+    }
+
+    pool.function      = function;
+    pool.arguments     = arguments;
+    pool.argument_size = argument_size;
+    pool.count         = count;
+    pool.next          = 0;
+    pool.finished      = 0;
+    cnd_broadcast(&pool.work);
+
+    pool_drain();
+    while (pool.finished < pool.count)
+        cnd_wait(&pool.done, &pool.lock);
+    pool.count = 0;
+    pool.next  = 0;
+    mtx_unlock(&pool.lock);
+
+    atomic_store_release(&pool_busy, 0);
+    return true;
+}
+
+#endif
+
+/// Run function once for each of the count arguments (each argument_size bytes apart), on the
+/// worker pool and the calling thread. Without C11 threads everything runs here.
+internal void threads_run(thread_function function, void *arguments, size_t argument_size, size_t count)
+{
+#ifndef __STDC_NO_THREADS__
+    assert(count <= TC_PARALLEL_MAX_THREADS);
+    if (count > 1 && pool_run(function, arguments, argument_size, count)) return;
+#endif
+    threads_spawn(function, arguments, argument_size, count);
+}
+
+//---------------------------------------------------------------------------
+// Parallel parsing
+//---------------------------------------------------------------------------
+
+/*
+    With TC_PARALLEL, files bigger than TC_PARALLEL_MIN_CHUNK are split at new lines into one
+    chunk per thread and lexed in two passes:
+      1. Every chunk is lexed from STATE_LINE only counting its lines, the line counts give the
+      first line of each chunk.
+      2. Every chunk is lexed again storing its lines from its first line, the key hashes are kept
+      in a temporary array.
+    Finally the keys are inserted in the index in line order, so duplicated keys keep the same
+    first wins behavior as a serial parse.
+
+    A new line isn't always a clean boundary (a key and its '=' can be on different lines), so
+    when a chunk doesn't end on STATE_LINE, or on any error, the file is parsed serially instead,
+    which also reports errors with the right line.
+*/
+
+#ifndef TC_PARALLEL_MIN_CHUNK
+#define TC_PARALLEL_MIN_CHUNK (256 * 1024)
+#endif
+
+typedef enum {
+    PARALLEL_PARSED,
+    PARALLEL_FAILED,
+    PARALLEL_SERIAL,
+} parallel_result;
+
+#ifndef __STDC_NO_THREADS__
+
+typedef struct {
+    tc_config    *config;
+    lexer_state   lexer;
+    char         *file_buffer;
+    size_t        begin;
+    size_t        end;
+    unsigned int  state;
+} parse_chunk;
+
+internal int parse_chunk_run(void *argument)
+{
+    parse_chunk *chunk = argument;
+    chunk->state = lexer_run(
+        chunk->config,
+        &chunk->lexer,
+        chunk->file_buffer,
+        chunk->begin,
+        chunk->end,
+        STATE_LINE
+    );
+    return 0;
+}
+
+internal size_t parse_thread_count(size_t file_bytes_read)
+{
+    size_t threads = thread_count();
+    size_t max_chunks = file_bytes_read / TC_PARALLEL_MIN_CHUNK;
+    if (threads > max_chunks) threads = max_chunks;
+    return threads;
+}
+
+internal parallel_result tc_parse_config_parallel(
+    tc_config *config,
+    lexer_state *lexer,
+    char *file_buffer,
+    size_t file_bytes_read
+) {
+    size_t chunk_count = parse_thread_count(file_bytes_read);
+    if (chunk_count < 2) return PARALLEL_SERIAL;
+
+    // Split the file just after a new line close to each equal part.
+    parse_chunk chunks[TC_PARALLEL_MAX_THREADS];
+    size_t begin = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < chunk_count && begin < file_bytes_read; i++)
+    {
+        size_t end = file_bytes_read;
+        if (i + 1 < chunk_count)
+        {
+            end = file_bytes_read / chunk_count * (i + 1);
+            if (end < begin) end = begin;
+            while (end < file_bytes_read && file_buffer[end] != '\n') end++;
+            if (end < file_bytes_read) end++;
+        }
+
+        chunks[count] = (parse_chunk) {
+            .config      = config,
+            .lexer       = *lexer,
+            .file_buffer = file_buffer,
+            .begin       = begin,
+            .end         = end,
+        };
+        chunks[count].lexer.count_only = true;
+        count += 1;
+        begin = end;
+    }
+
+    // First pass, count the lines of each chunk.
+    threads_run(parse_chunk_run, chunks, sizeof(parse_chunk), count);
+
+    size_t lines = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        bool last = i + 1 == count;
+        if (chunks[i].state == STATE_ERROR) return PARALLEL_SERIAL;
+        if (!last && chunks[i].state != STATE_LINE) return PARALLEL_SERIAL;
+
+        size_t chunk_lines = chunks[i].lexer.current_line;
+        chunks[i].lexer.count_only   = false;
+        chunks[i].lexer.current_line = lines;
+        lines += chunk_lines;
+        // A value that ends with the file is completed after the last chunk.
+        if (last && chunks[i].state == STATE_VALUE) lines += 1;
+    }
+
+    // Let the serial parse report it, TC_GROW configs get all the lines they need before the
+    // threads store them. The last chunk can also store the key of a last line without a value.
+    bool grow = config->flags & TC_GROW;
+    if (!grow && lines > TC_CONFIG_MAX_SIZE) return PARALLEL_SERIAL;
+    size_t reserved = grow || lines < TC_CONFIG_MAX_SIZE ? lines + 1 : lines;
+    if (!lines_reserve(config, reserved) || !index_reserve(config, lines)) return PARALLEL_FAILED;
+
+    size_t hashes_size = sizeof(uint32_t) * (lines > 0 ? lines : 1);
+    uint32_t *hashes = memory_alloc(global_allocator, hashes_size);
+    if (hashes == NULL) return PARALLEL_SERIAL;
+
+    // Second pass, store the lines.
+    for (size_t i = 0; i < count; i++)
+    {
+        chunks[i].lexer.hashes         = hashes;
+        chunks[i].lexer.reserved_lines = reserved;
+    }
+    threads_run(parse_chunk_run, chunks, sizeof(parse_chunk), count);
+
+    bool success = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (chunks[i].state == STATE_ERROR) success = false;
+    }
+
+    parse_chunk *last = &chunks[count - 1];
+    if (success && last->state == STATE_VALUE)
+        success = lexer_value(config, &last->lexer, file_buffer, file_bytes_read);
+
+    // Merge the indexes in line order.
+    if (success)
+    {
+        config->size = lines;
+        for (size_t i = 0; i < lines && success; i++)
+            success = index_insert_hash(config, i, hashes[i]);
+    }
+
+    memory_free(global_allocator, hashes, hashes_size);
+    return success ? PARALLEL_PARSED : PARALLEL_FAILED;
+}
+
+#endif
+
+internal bool tc_parse_config(tc_config *config, char *file_buffer, size_t file_bytes_read)
+{
+    assert(config->buffer != NULL || (config->flags & TC_GROW));
+    assert(file_bytes_read > 0);
+
+    lexer_state lexer = {
+        .view      = config->flags & TC_VIEW,
+        .in_source = config->flags & (TC_VIEW | TC_LAZY),
+    };
+
+    if (lexer.in_source && (TC_LINE_MAX_SIZE < sizeof(source_line) || file_bytes_read > UINT32_MAX))
+    {
+        ERROR_REPORT(
+            "TC_LAZY and TC_VIEW need TC_LINE_MAX_SIZE >= %zi and files smaller than 4GB",
+            sizeof(source_line)
+        );
+        return false;
+    }
+
+    parallel_result parallel = PARALLEL_SERIAL;
+#ifndef __STDC_NO_THREADS__
+    if (config->flags & TC_PARALLEL)
+        parallel = tc_parse_config_parallel(config, &lexer, file_buffer, file_bytes_read);
+#endif
+
+    if (parallel == PARALLEL_FAILED) return false;
+    if (parallel == PARALLEL_SERIAL)
+    {
+        unsigned int state = lexer_run(config, &lexer, file_buffer, 0, file_bytes_read, STATE_LINE);
+        if (state == STATE_ERROR) return false;
+
+        // A value can end with the file, a key without a value is ignored.
+        if (state == STATE_VALUE && !lexer_value(config, &lexer, file_buffer, file_bytes_read))
+            return false;
+    }
+
+    // Values are null terminated only after lexing, as the terminators are still needed by it.
+    if (lexer.view)
+    {
+        for (size_t i = 0; i < config->size; i++)
+            file_buffer[source_line_read(config, i).value_end + 1] = '\0';
+    }
+
+    return layout_loaded(config);
+}
+
+//---------------------------------------------------------------------------
+// Scratch buffers
+//---------------------------------------------------------------------------
+
+/*
+    Files are read into config->scratch, which is kept between loads. TC_LAZY and TC_VIEW configs
+    keep the file as their source, so the scratch buffer and the source are swapped after each
+    read: reloads go back and forth between the two buffers and stop allocating once both fit the
+    file. A borrowed scratch buffer (tc_set_scratch) can't be swapped, it holds the source itself
+    and the source is lost as soon as the next file is read into it.
+*/
+
+/// Free the source unless it lives in the borrowed scratch buffer or snapshots share it.
+internal void config_source_free(tc_config *config)
+{
+    shared_detach(config);
+    if (config->source != config->scratch.data)
+        memory_free(config_allocator(config), config->source, config->source_capacity);
+    config->source          = NULL;
+    config->source_capacity = 0;
+}
+
+/// Read the file into the scratch buffer of the config, empty files fail.
+internal bool config_read(tc_config *config, const char *file_path, size_t *bytes_read)
+{
+    if (config->scratch.borrowed && config->source == config->scratch.data)
+    {
+        config->source = NULL;
+        config->size   = 0;
+    }
+    return file_read_into(file_path, config_allocator(config), &config->scratch, bytes_read) && *bytes_read > 0;
+}
+
+/// Return the file just read into the scratch buffer, after making it the source of TC_LAZY and
+/// TC_VIEW configs. The previous source is released or becomes the next scratch buffer.
+internal char *config_file_take(tc_config *config)
+{
+    // A source shared with snapshots can't become the next scratch buffer.
+    shared_detach(config);
+    tc_scratch *scratch = &config->scratch;
+    char *file_buffer = scratch->data;
+    bool keep_source  = config->flags & (TC_LAZY | TC_VIEW);
+
+    if (!keep_source || scratch->borrowed)
+    {
+        config_source_free(config);
+        if (keep_source) config->source = file_buffer;
+        return file_buffer;
+    }
+
+    char *previous           = config->source;
+    size_t previous_capacity = config->source_capacity;
+
+    config->source          = file_buffer;
+    config->source_capacity = scratch->capacity;
+    scratch->data           = previous;
+    scratch->capacity       = previous_capacity;
+    return file_buffer;
+}
+
+//---------------------------------------------------------------------------
+// Directories
+//---------------------------------------------------------------------------
+
+/*
+    tc_load_directory reads and parses every matching file of a directory on its own config, with
+    the files split between TC_PARALLEL_THREADS threads, and then merges them in lexical file
+    order:
+      - Inside of a file the first line of a key wins, as in tc_load_config.
+      - A file overrides the keys of the files before it, the line keeps its first position.
+    The files are lexed without an index, their key hashes are kept instead and the merged index
+    is the only one built.
+*/
+
+typedef struct {
+    char     *path;
+    tc_config config;
+    uint32_t *hashes;
+    size_t    capacity;
+    bool      success;
+} directory_file;
+
+typedef struct {
+    directory_file *files;
+    size_t          count;
+    size_t          first;
+    size_t          step;
+    tc_scratch      scratch;
+} directory_worker;
+
+internal int string_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/// Join the directory and the file name into a new string.
+internal char *path_join(const char *directory, const char *name)
+{
+    size_t directory_length = strlen(directory);
+    size_t name_length      = strlen(name);
+    char *path = memory_alloc(global_allocator, directory_length + name_length + 2);
+    if (path == NULL) return NULL;
+
+    memcpy(path, directory, directory_length);
+    path[directory_length] = '/';
+    memcpy(&path[directory_length + 1], name, name_length + 1);
+    return path;
+}
+
+typedef struct {
+    char  **paths;
+    size_t  count;
+    size_t  capacity;
+} path_list;
+
+internal void path_free(char *path)
+{
+    if (path != NULL) memory_free(global_allocator, path, strlen(path) + 1);
+}
+
+internal bool path_list_push(path_list *list, char *path)
+{
+    if (path == NULL) return false;
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+        char **paths = memory_grow(
+            global_allocator, list->paths, sizeof(char *) * list->capacity, sizeof(char *) * capacity
+        );
+        if (paths == NULL)
+        {
+            path_free(path);
+            return false;
+        }
+        list->paths    = paths;
+        list->capacity = capacity;
+    }
+
+    list->paths[list->count] = path;
+    list->count += 1;
+    return true;
+}
+
+internal void path_list_free(path_list *list)
+{
+    for (size_t i = 0; i < list->count; i++) path_free(list->paths[i]);
+    memory_free(global_allocator, list->paths, sizeof(char *) * list->capacity);
+    *list = (path_list) {0};
+}
+
+/// List the regular files in directory whose names match the pattern (every file when pattern is
+/// NULL) in lexical order. Hidden files are skipped.
+internal bool directory_list(const char *directory, const char *pattern, path_list *list)
+{
+    bool success = true;
+#if defined(__unix__) || defined(__APPLE__)
+    DIR *dir = opendir(directory);
+    if (dir == NULL) return false;
+
+    for (struct dirent *entry = readdir(dir); entry != NULL && success; entry = readdir(dir))
+    {
+        const char *name = entry->d_name;
+        if (name[0] == '.') continue;
+        if (pattern != NULL && fnmatch(pattern, name, 0) != 0) continue;
+
+        char *path = path_join(directory, name);
+        struct stat file_stat;
+        if (path != NULL && (stat(path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)))
+        {
+            path_free(path);
+            continue;
+        }
+        success = path_list_push(list, path);
+    }
+    closedir(dir);
+#elif defined(_WIN32)
+    char *search = path_join(directory, pattern != NULL ? pattern : "*");
+    if (search == NULL) return false;
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(search, &data);
+    path_free(search);
+    // A directory without matching files is still a directory.
+    if (find == INVALID_HANDLE_VALUE) return GetLastError() == ERROR_FILE_NOT_FOUND;
+
+    do
+    {
+        if (data.cFileName[0] == '.') continue;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        success = path_list_push(list, path_join(directory, data.cFileName));
+    }
+    while (success && FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    (void) pattern;
+    ERROR_REPORT("directories can't be listed on this platform (%s)", directory);
+    success = false;
+#endif
+
+    if (!success)
+    {
+        path_list_free(list);
+        return false;
+    }
+
+    if (list->count > 1) qsort(list->paths, list->count, sizeof(char *), string_compare);
+    return true;
+}
+
+/// Read and lex one file of the directory on its own buffer, without an index. Each thread reads
+/// its files into the same scratch buffer.
+internal bool directory_file_parse(directory_file *file, tc_scratch *scratch)
+{
+    size_t bytes_read;
+    if (!file_read_into(file->path, global_allocator, scratch, &bytes_read)) return false;
+    char *file_buffer = scratch->data;
+
+    // TC_GROW files store their lines in chunks, the others in a buffer for all of them.
+    bool grow = file->config.flags & TC_GROW;
+    // At least one line, a file with a single key and no value still lexes it.
+    size_t capacity = file_line_capacity(file_buffer, bytes_read, grow);
+    if (!grow) file->config.buffer = memory_alloc(global_allocator, capacity * TC_LINE_TOTAL_SIZE);
+    file->hashes   = memory_alloc(global_allocator, capacity * sizeof(uint32_t));
+    file->capacity = capacity;
+    bool success = (grow || file->config.buffer != NULL) && file->hashes != NULL;
+
+    lexer_state lexer = { .hashes = file->hashes };
+    if (success)
+    {
+        unsigned int state = lexer_run(&file->config, &lexer, file_buffer, 0, bytes_read, STATE_LINE);
+        success = state != STATE_ERROR;
+        if (success && state == STATE_VALUE)
+            success = lexer_value(&file->config, &lexer, file_buffer, bytes_read);
+    }
+    file->config.size = lexer.current_line;
+    return success;
+}
+
+internal int directory_worker_run(void *argument)
+{
+    directory_worker *worker = argument;
+    for (size_t i = worker->first; i < worker->count; i += worker->step)
+        worker->files[i].success = directory_file_parse(&worker->files[i], &worker->scratch);
+    return 0;
+}
+
+/// Merge the parsed files into config in file order, config must be empty and have an index
+/// unless it's TC_GROW.
+internal bool directory_merge(tc_config *config, directory_file *files, size_t count)
+{
+    size_t lines = 0;
+    for (size_t f = 0; f < count; f++)
+        lines += files[f].config.size;
+
+    // File that wrote each merged line last, to keep the first line of a key inside of a file.
+    size_t line_file_size = sizeof(size_t) * (lines > 0 ? lines : 1);
+    size_t *line_file = memory_alloc(global_allocator, line_file_size);
+    if (line_file == NULL) return false;
+
+    bool success = true;
+    for (size_t f = 0; f < count && success; f++)
+    {
+        tc_config *file_config = &files[f].config;
+        for (size_t i = 0; i < file_config->size; i++)
+        {
+            void *location = line_get(file_config, i);
+            size_t key_length;
+            const char *key_start = line_key(file_config, i, &key_length);
+            size_t line = index_find_hash(config, key_start, key_length, files[f].hashes[i]);
+
+            if (line != LINE_NOT_FOUND)
+            {
+                if (line_file[line] == f) continue;
+                memcpy(line_get(config, line), location, TC_LINE_TOTAL_SIZE);
+                line_file[line] = f;
+                continue;
+            }
+
+            if (!lines_reserve(config, config->size + 1))
+            {
+                ERROR_REPORT("failed to merge %s", files[f].path);
+                success = false;
+                break;
+            }
+
+            memcpy(line_get(config, config->size), location, TC_LINE_TOTAL_SIZE);
+            line_file[config->size] = f;
+            success = index_insert_hash(config, config->size, files[f].hashes[i]);
+            if (!success) break;
+            config->size += 1;
+        }
+    }
+
+    memory_free(global_allocator, line_file, line_file_size);
+    return success;
+}
+
+//---------------------------------------------------------------------------
+// Batch loading
+//---------------------------------------------------------------------------
+
+/*
+    tc_load_configs loads many files, each one into its own config with a line buffer and an index
+    sized for the file (TC_OWNED). On Linux the opens, statx calls, reads and closes of up to
+    TC_IO_URING_ENTRIES / 2 files are in flight at once on an io_uring, and each file is parsed as
+    soon as its read completes, while the reads of the next files are still running. When
+    io_uring isn't available or lacks one of these operations (kernels before 5.6, seccomp filters
+    or TC_NO_IO_URING) the files are split between TC_PARALLEL_THREADS threads that load them with
+    pread. Every file is read into the scratch buffer of its config.
+*/
+
+#ifndef TC_IO_URING_ENTRIES
+#define TC_IO_URING_ENTRIES 64
+#endif
+
+/// Parse the file read into the scratch buffer of the config, with a line buffer and an index of
+/// its own. The storage of the previous load is kept when it's big enough.
+internal bool config_owned_parse(tc_config *config, size_t bytes_read)
+{
+    config->size = 0;
+    char *file_buffer = config_file_take(config);
+
+    // One line and two index entries at least, so that an empty config still has storage.
+    size_t capacity = file_line_capacity(file_buffer, bytes_read, false);
+    if (config->flags & TC_GROW)
+    {
+        config_grow_prepare(config);
+    }
+    else if ((config->flags & TC_OWNED) && config->chunks == NULL && config->index_size >= capacity * 2)
+    {
+        memset(config->index, 0, config->index_size * sizeof(tc_index_entry));
+    }
+    else
+    {
+        const tc_allocator *allocator = config_allocator(config);
+        config_owned_free(config);
+        config->buffer     = memory_alloc(allocator, capacity * TC_LINE_TOTAL_SIZE);
+        config->index      = memory_calloc(allocator, capacity * 2, sizeof(tc_index_entry));
+        config->index_size = capacity * 2;
+        config->flags     |= TC_OWNED;
+    }
+
+    bool storage = (config->flags & TC_GROW) || (config->buffer != NULL && config->index != NULL);
+    bool success = storage && tc_parse_config(config, file_buffer, bytes_read);
+    if (!success)
+    {
+        config_owned_free(config);
+        config->size = 0;
+    }
+    return success;
+}
+
+typedef struct {
+    tc_config         *configs;
+    const char *const *file_paths;
+    bool              *loaded;
+    size_t             count;
+    size_t             first;
+    size_t             step;
+} batch_worker;
+
+internal int batch_worker_run(void *argument)
+{
+    batch_worker *worker = argument;
+    for (size_t i = worker->first; i < worker->count; i += worker->step)
+    {
+        if (worker->loaded[i]) continue;
+
+        tc_config *config = &worker->configs[i];
+        size_t bytes_read;
+        worker->loaded[i] = config_read(config, worker->file_paths[i], &bytes_read)
+            && config_owned_parse(config, bytes_read);
+    }
+    return 0;
+}
+
+internal void batch_load_threads(tc_config *configs, const char *const *file_paths, bool *loaded, size_t count)
+{
+    size_t threads = thread_count();
+    if (threads > count) threads = count;
+
+    batch_worker workers[TC_PARALLEL_MAX_THREADS];
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers[i] = (batch_worker) {
+            .configs    = configs,
+            .file_paths = file_paths,
+            .loaded     = loaded,
+            .count      = count,
+            .first      = i,
+            .step       = threads,
+        };
+    }
+    threads_run(batch_worker_run, workers, sizeof(batch_worker), threads);
+}
+
+#ifdef TC_IO_URING
+
+/// Submission and completion rings shared with the kernel, without liburing.
+typedef struct {
+    int                  fd;
+    unsigned int        *sq_head;
+    unsigned int        *sq_tail;
+    unsigned int        *sq_mask;
+    unsigned int        *sq_array;
+    unsigned int        *cq_head;
+    unsigned int        *cq_tail;
+    unsigned int        *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ring;
+    size_t               sq_ring_size;
+    void                *cq_ring;
+    size_t               cq_ring_size;
+    size_t               sqes_size;
+    unsigned int         entries;
+    unsigned int         queued;
+} uring;
+
+/// Whether the ring supports every operation of the batch. Kernels before 5.6 have neither these
+/// operations nor IORING_REGISTER_PROBE, and fail their entries with -EINVAL.
+internal bool uring_probe(int fd)
+{
+    static const unsigned char opcodes[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+    size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = memory_calloc(global_allocator, 1, probe_size);
+    if (probe == NULL) return false;
+
+    bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) >= 0;
+    for (size_t i = 0; supported && i < sizeof(opcodes); i++)
+    {
+        unsigned char opcode = opcodes[i];
+        supported = opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+    memory_free(global_allocator, probe, probe_size);
+    return supported;
+}
+
+internal bool uring_open(uring *ring, unsigned int entries)
+{
+    struct io_uring_params params = {0};
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) return false;
+    if (!uring_probe(fd))
+    {
+        close(fd);
+        return false;
+    }
+
+    *ring = (uring) { .fd = fd, .entries = params.sq_entries };
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring
+        : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        if (!single_mmap && ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        close(fd);
+        return false;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_head  = (unsigned int *) (sq + params.sq_off.head);
+    ring->sq_tail  = (unsigned int *) (sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned int *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq + params.sq_off.array);
+    ring->cq_head  = (unsigned int *) (cq + params.cq_off.head);
+    ring->cq_tail  = (unsigned int *) (cq + params.cq_off.tail);
+    ring->cq_mask  = (unsigned int *) (cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return true;
+}
+
+internal void uring_close(uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/// Return a cleared submission entry tagged with user_data, the caller keeps the amount of
+/// operations in flight below the ring entries.
+internal struct io_uring_sqe *uring_sqe(uring *ring, uint64_t user_data)
+{
+    unsigned int tail = *ring->sq_tail + ring->queued;
+    assert(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) < ring->entries);
+
+    unsigned int slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    ring->sq_array[slot] = slot;
+    ring->queued += 1;
+    return sqe;
+}
+
+/// Submit the queued entries and wait for at least wait completions.
+internal bool uring_submit(uring *ring, unsigned int wait)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+    unsigned int submit = ring->queued;
+    ring->queued = 0;
+
+    for (;;)
+    {
+        long result = syscall(
+            __NR_io_uring_enter, ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0
+        );
+        if (result >= 0) return true;
+        if (errno != EINTR) return false;
+        // Entries consumed before the interruption aren't submitted again.
+        submit = 0;
+    }
+}
+
+enum {
+    BATCH_OPEN,
+    BATCH_STATX,
+    BATCH_READ,
+    BATCH_CLOSE,
+};
+
+typedef struct {
+    size_t        file_size;
+    size_t        bytes_read;
+    size_t        asked;
+    int           fd;
+    int           pending;
+    bool          failed;
+    bool          probing;
+    char          probe;
+    struct statx  file_statx;
+} batch_file;
+
+/// Files in flight on the ring, files whose read finished wait in ready to be parsed.
+typedef struct {
+    uring      *ring;
+    tc_config  *configs;
+    batch_file *files;
+    size_t     *ready;
+    size_t      ready_count;
+    size_t      active;
+    size_t      done;
+} batch;
+
+internal uint64_t batch_user_data(size_t file, unsigned int operation)
+{
+    return ((uint64_t) file << 2) | operation;
+}
+
+/// Read the rest of the scratch buffer, keeping room for the null terminator. When the buffer is
+/// full one byte is read into probe instead, to check whether the file grew after statx.
+internal void batch_read_submit(batch *batch, size_t i)
+{
+    batch_file *file = &batch->files[i];
+    tc_scratch *scratch = &batch->configs[i].scratch;
+    // Reads are capped at 1GB, bigger files continue with more reads.
+    size_t remaining = scratch->capacity - file->bytes_read - 1;
+    if (remaining > (1u << 30)) remaining = 1u << 30;
+    file->probing = remaining == 0;
+    file->asked   = file->probing ? 1 : remaining;
+
+    struct io_uring_sqe *sqe = uring_sqe(batch->ring, batch_user_data(i, BATCH_READ));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd     = file->fd;
+    sqe->addr   = (uint64_t) (uintptr_t) (file->probing ? &file->probe : &scratch->data[file->bytes_read]);
+    sqe->len    = (uint32_t) file->asked;
+    sqe->off    = file->bytes_read;
+    file->pending += 1;
+}
+
+/// Handle a completed read, return whether the file needs another one. Like file_read_into,
+/// reading stops at a read of 0 or at a short read past the size given by statx, so a file that
+/// grew after statx is read whole and one that shrank ends early.
+internal bool batch_read_complete(batch *batch, size_t i, int result)
+{
+    batch_file *file = &batch->files[i];
+    if (result < 0)
+    {
+        file->failed = true;
+        return false;
+    }
+    if (result == 0) return false;
+
+    if (file->probing)
+    {
+        // The byte is read again once the buffer grew.
+        tc_config *config = &batch->configs[i];
+        tc_scratch *scratch = &config->scratch;
+        if (!scratch_reserve(config_allocator(config), scratch, scratch->capacity + 1, scratch->capacity * 2))
+            file->failed = true;
+        return !file->failed;
+    }
+
+    file->bytes_read += (size_t) result;
+    return (size_t) result == file->asked || file->bytes_read < file->file_size;
+}
+
+/// Close the file, it is done once the close completes.
+internal void batch_close_submit(batch *batch, size_t i)
+{
+    batch_file *file = &batch->files[i];
+    if (file->fd >= 0)
+    {
+        struct io_uring_sqe *sqe = uring_sqe(batch->ring, batch_user_data(i, BATCH_CLOSE));
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd     = file->fd;
+        file->fd = -1;
+        file->pending += 1;
+    }
+    if (file->pending == 0)
+    {
+        batch->active -= 1;
+        batch->done   += 1;
+    }
+}
+
+internal void batch_start(batch *batch, const char *file_path, size_t i)
+{
+    batch_file *file = &batch->files[i];
+    file->fd = -1;
+
+    tc_config *config = &batch->configs[i];
+    if (config->scratch.borrowed && config->source == config->scratch.data)
+    {
+        config->source = NULL;
+        config->size   = 0;
+    }
+
+    struct io_uring_sqe *sqe = uring_sqe(batch->ring, batch_user_data(i, BATCH_OPEN));
+    sqe->opcode     = IORING_OP_OPENAT;
+    sqe->fd         = AT_FDCWD;
+    sqe->addr       = (uint64_t) (uintptr_t) file_path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+    sqe = uring_sqe(batch->ring, batch_user_data(i, BATCH_STATX));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd     = AT_FDCWD;
+    sqe->addr   = (uint64_t) (uintptr_t) file_path;
+    sqe->len    = STATX_SIZE;
+    sqe->off    = (uint64_t) (uintptr_t) &file->file_statx;
+
+    file->pending  = 2;
+    batch->active += 1;
+}
+
+/// Handle one completion and queue the next operation of its file.
+internal void batch_complete(batch *batch, struct io_uring_cqe *cqe)
+{
+    size_t i = (size_t) (cqe->user_data >> 2);
+    batch_file *file = &batch->files[i];
+    file->pending -= 1;
+
+    switch (cqe->user_data & 3)
+    {
+        case BATCH_OPEN:
+            if (cqe->res < 0) file->failed = true;
+            else file->fd = cqe->res;
+            break;
+        case BATCH_STATX:
+            if (cqe->res < 0) file->failed = true;
+            break;
+        case BATCH_READ:
+            if (batch_read_complete(batch, i, cqe->res))
+            {
+                batch_read_submit(batch, i);
+                return;
+            }
+            if (!file->failed) batch->ready[batch->ready_count++] = i;
+            batch_close_submit(batch, i);
+            return;
+        case BATCH_CLOSE:
+            batch_close_submit(batch, i);
+            return;
+    }
+
+    // Wait for both the open and the statx.
+    if (file->pending > 0) return;
+    if (!file->failed)
+    {
+        // The file is read into the scratch buffer of its config, sized like file_read_into does
+        // with the size given by statx, and the reads go on until the end of the file.
+        file->file_size = (size_t) file->file_statx.stx_size;
+        tc_config *config = &batch->configs[i];
+        if (!scratch_reserve(config_allocator(config), &config->scratch, file->file_size + 1, file->file_size + 2))
+            file->failed = true;
+    }
+
+    if (!file->failed)
+    {
+        batch_read_submit(batch, i);
+        return;
+    }
+    batch_close_submit(batch, i);
+}
+
+/// Reap the available completions, waiting for at least one.
+internal bool batch_reap(batch *batch)
+{
+    uring *ring = batch->ring;
+    if (!uring_submit(ring, 1)) return false;
+
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+        batch_complete(batch, &ring->cqes[head & *ring->cq_mask]);
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+/// Load the files through the ring, false is returned when the ring stops working and the files
+/// that weren't loaded are left to the fallback.
+internal bool batch_load_uring(uring *ring, tc_config *configs, const char *const *file_paths, bool *loaded, size_t count)
+{
+    batch batch = {
+        .ring    = ring,
+        .configs = configs,
+        .files   = memory_calloc(global_allocator, count, sizeof(batch_file)),
+        .ready   = memory_alloc(global_allocator, count * sizeof(size_t)),
+    };
+    bool success = batch.files != NULL && batch.ready != NULL;
+
+    // Each file has at most two operations in flight (open and statx).
+    size_t max_active = ring->entries / 2;
+    size_t next = 0;
+    while (success && batch.done < count)
+    {
+        for (; next < count && batch.active < max_active; next++)
+            batch_start(&batch, file_paths[next], next);
+
+        success = batch_reap(&batch);
+        // The operations queued by the completions are submitted before parsing, so that the
+        // kernel works on them meanwhile.
+        if (success && ring->queued > 0) success = uring_submit(ring, 0);
+
+        for (size_t r = 0; r < batch.ready_count; r++)
+        {
+            size_t i = batch.ready[r];
+            size_t bytes_read = batch.files[i].bytes_read;
+            configs[i].scratch.data[bytes_read] = '\0';
+            loaded[i] = bytes_read > 0 && config_owned_parse(&configs[i], bytes_read);
+        }
+        batch.ready_count = 0;
+    }
+
+    // The operations still in flight point to the files, wait for them before freeing.
+    while (!success && batch.active > 0 && batch_reap(&batch)) {}
+
+    if (batch.files != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (batch.files[i].fd >= 0) close(batch.files[i].fd);
+        }
+    }
+    memory_free(global_allocator, batch.files, count * sizeof(batch_file));
+    memory_free(global_allocator, batch.ready, count * sizeof(size_t));
+    return success;
+}
+
+#endif
+
+//---------------------------------------------------------------------------
+// Fingerprints
+//---------------------------------------------------------------------------
+
+/*
+    tc_reload_if_changed keeps a fingerprint of the file that was last loaded: the device, inode,
+    size and modification time given by stat, and a hash of the content. When stat gives the same
+    values the file isn't even read, otherwise it's read and only parsed when the content hash
+    differs (a file written again with the same content, or touched, isn't parsed). The content
+    hash is XXH64, it's computed before parsing as TC_VIEW writes null terminators into the file
+    buffer. It's only compared inside of the process, so the endianness of the reads doesn't
+    matter.
+
+    Only tc_reload_if_changed and tc_reload_staged hash the file, tc_load_config leaves the
+    fingerprint empty so that a plain load doesn't pay for a pass over the whole file. The first
+    tc_reload_if_changed after it has nothing to compare with and parses the file again, polling
+    with tc_reload_if_changed from the first load avoids that.
+*/
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+internal uint64_t rotate_left64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+internal uint64_t read64(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+internal uint64_t xxh64_round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * XXH_PRIME64_2;
+    return rotate_left64(accumulator, 31) * XXH_PRIME64_1;
+}
+
+internal uint64_t xxh64_merge(uint64_t hash, uint64_t accumulator)
+{
+    hash ^= xxh64_round(0, accumulator);
+    return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/// XXH64 of size bytes of data, with a seed of 0.
+internal uint64_t content_hash(const char *data, size_t size)
+{
+    const char *end = data + size;
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        uint64_t accumulators[4] = {
+            XXH_PRIME64_1 + XXH_PRIME64_2, XXH_PRIME64_2, 0, 0 - XXH_PRIME64_1
+        };
+        for (; data + 32 <= end; data += 32)
+        {
+            for (int i = 0; i < 4; i++)
+                accumulators[i] = xxh64_round(accumulators[i], read64(data + (8 * i)));
+        }
+
+        hash = rotate_left64(accumulators[0], 1) + rotate_left64(accumulators[1], 7)
+            + rotate_left64(accumulators[2], 12) + rotate_left64(accumulators[3], 18);
+        for (int i = 0; i < 4; i++)
+            hash = xxh64_merge(hash, accumulators[i]);
+    }
+    else
+    {
+        hash = XXH_PRIME64_5;
+    }
+    hash += size;
+
+    for (; data + 8 <= end; data += 8)
+    {
+        hash ^= xxh64_round(0, read64(data));
+        hash = rotate_left64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (data + 4 <= end)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        hash ^= value * XXH_PRIME64_1;
+        hash = rotate_left64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        data += 4;
+    }
+    for (; data < end; data++)
+    {
+        hash ^= (unsigned char) *data * XXH_PRIME64_5;
+        hash = rotate_left64(hash, 11) * XXH_PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/// Fill the stat part of the fingerprint, only available on POSIX.
+internal bool fingerprint_stat(const char *file_path, tc_fingerprint *fingerprint)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat file_stat;
+    if (stat(file_path, &file_stat) != 0) return false;
+
+    fingerprint->device  = (uint64_t) file_stat.st_dev;
+    fingerprint->inode   = (uint64_t) file_stat.st_ino;
+    fingerprint->size    = (uint64_t) file_stat.st_size;
+#ifdef __APPLE__
+    fingerprint->modified_seconds     = (int64_t) file_stat.st_mtimespec.tv_sec;
+    fingerprint->modified_nanoseconds = (int64_t) file_stat.st_mtimespec.tv_nsec;
+#else
+    fingerprint->modified_seconds     = (int64_t) file_stat.st_mtim.tv_sec;
+    fingerprint->modified_nanoseconds = (int64_t) file_stat.st_mtim.tv_nsec;
+#endif
+    fingerprint->has_stat = true;
+    return true;
+#else
+    (void) file_path;
+    (void) fingerprint;
+    return false;
+#endif
+}
+
+internal bool fingerprint_stat_equal(const tc_fingerprint *first, const tc_fingerprint *second)
+{
+    return first->has_stat && second->has_stat
+        && first->device == second->device
+        && first->inode == second->inode
+        && first->size == second->size
+        && first->modified_seconds == second->modified_seconds
+        && first->modified_nanoseconds == second->modified_nanoseconds;
+}
+
+//---------------------------------------------------------------------------
+// Sequence lock
+//---------------------------------------------------------------------------
+
+/*
+    tc_set_value changes values in place while other threads may be reading them. config->sequence
+    is odd while a value is written: a writer makes it odd with a compare exchange, which also
+    keeps writers from running at the same time, and even again once the value is written.
+    tc_get_value_copy copies the value out between two reads of the sequence and retries when it
+    changed in between, so readers never block writers nor each other.
+*/
+
+internal void sequence_write_begin(tc_config *config)
+{
+    for (;;)
+    {
+        uint32_t sequence = atomic_load_acquire(&config->sequence);
+        if (!(sequence & 1) && atomic_compare_exchange(&config->sequence, sequence, sequence + 1))
+            break;
+    }
+    // The value can't be written before the sequence is odd.
+    atomic_fence_release();
+}
+
+internal void sequence_write_end(tc_config *config)
+{
+    atomic_store_release(&config->sequence, config->sequence + 1);
+}
+
+/// Wait for the writer in progress and return the sequence to check after reading.
+internal uint32_t sequence_read_begin(tc_config *config)
+{
+    uint32_t sequence = atomic_load_acquire(&config->sequence);
+    while (sequence & 1) sequence = atomic_load_acquire(&config->sequence);
+    return sequence;
+}
+
+/// Whether a value was written since sequence_read_begin returned sequence.
+internal bool sequence_read_retry(tc_config *config, uint32_t sequence)
+{
+    // The value has to be read before the sequence is checked.
+    atomic_fence_acquire();
+    return atomic_load_acquire(&config->sequence) != sequence;
+}
+
+//---------------------------------------------------------------------------
+// Generations
+//---------------------------------------------------------------------------
+
+/*
+    config->generation is bumped by every load and by tc_set_value, so that callers can cache what
+    they derive from values and revalidate it with a single atomic load (tc_generation) instead of
+    a lookup. TC_LINE_GENERATIONS configs also keep the generation that last changed each line in
+    config->line_generations, read by tc_key_generation, so that a change to one key doesn't
+    invalidate what was derived from the others. Generations are only bumped by writers, which
+    never run at the same time, so a plain increment followed by a release store is enough.
+*/
+
+internal uint32_t generation_bump(tc_config *config)
+{
+    uint32_t generation = config->generation + 1;
+    atomic_store_release(&config->generation, generation);
+    return generation;
+}
+
+/// Bump the generation of a config that was just loaded (or emptied by a failed load), all of its
+/// lines changed.
+internal bool generation_loaded(tc_config *config)
+{
+    uint32_t generation = generation_bump(config);
+    if (!(config->flags & TC_LINE_GENERATIONS)) return true;
+
+    size_t size = config->size;
+    if (config->line_generations_capacity < size)
+    {
+        const tc_allocator *allocator = config_allocator(config);
+        memory_free(
+            allocator, config->line_generations, config->line_generations_capacity * sizeof(uint32_t)
+        );
+        config->line_generations          = memory_alloc(allocator, size * sizeof(uint32_t));
+        config->line_generations_capacity = config->line_generations != NULL ? size : 0;
+        if (config->line_generations == NULL) return false;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        atomic_store_release(&config->line_generations[i], generation);
+    return true;
+}
+
+/// Record that the line changed at generation, called by writers under config->sequence.
+internal void generation_line_set(tc_config *config, size_t line, uint32_t generation)
+{
+    if (line < config->line_generations_capacity)
+        atomic_store_release(&config->line_generations[line], generation);
+}
+
+/// Bump the generation for a change to the line, called by writers under config->sequence.
+internal void generation_line_changed(tc_config *config, size_t line)
+{
+    generation_line_set(config, line, generation_bump(config));
+}
+
+//---------------------------------------------------------------------------
+// Read cache
+//---------------------------------------------------------------------------
+
+/*
+    TC_READ_CACHE configs look keys up through a direct mapped cache of TC_READ_CACHE_SIZE entries
+    kept by each thread, indexed by the key hash. An entry keeps the line and value found for a
+    key, and is valid while the generation of the config is the one it was filled at, so a hot
+    key costs its hash, one comparison with the copy of the key kept in the entry and an atomic
+    load, instead of probing the index. The copy keeps hits on memory of the thread, away from the
+    lines other threads write. Misses, and keys of TC_LINE_MAX_SIZE bytes or more, aren't cached.
+
+    Moving or releasing lines without a load or a set doesn't bump the generation, and a config
+    can be released and another one loaded at the same address up to the same generation, so
+    tc_free_config, tc_set_scratch, tc_snapshot_release and tc_optimize_layout bump
+    read_cache_resets instead, which every entry is also checked against. A config cleared
+    without tc_free_config isn't seen by either, so entries also keep the number of the storage
+    record they were filled from.
+*/
+
+_Static_assert((TC_READ_CACHE_SIZE & (TC_READ_CACHE_SIZE - 1)) == 0, "TC_READ_CACHE_SIZE must be a power of two");
+
+typedef struct {
+    tc_config  *config;
+    uint32_t    generation;
+    uint32_t    resets;
+    uint32_t    load;
+    uint32_t    hash;
+    size_t      key_length;
+    size_t      line;
+    tc_str      value;
+    char        key[TC_LINE_MAX_SIZE];
+} read_cache_entry;
+
+internal TC_THREAD_LOCAL read_cache_entry read_cache[TC_READ_CACHE_SIZE];
+internal uint32_t read_cache_resets = 0;
+
+/// Invalidate the read cache entries of every thread.
+internal void read_cache_reset(void)
+{
+    atomic_increment(&read_cache_resets);
+}
+
+/// Find the value of the key through the read cache of the thread, a miss looks it up in the
+/// index and fills the entry of the key. Return its line, or LINE_NOT_FOUND.
+internal size_t read_cache_find(tc_config *config, const char *key, tc_str *value)
+{
+    size_t key_length;
+    uint32_t hash = key_hash_null(key, &key_length);
+
+    // Loaded before the lookup, so that an entry filled across a set is already stale.
+    uint32_t generation = atomic_load_acquire(&config->generation);
+    uint32_t resets     = atomic_load_acquire(&read_cache_resets);
+
+    // Loaded after the generation, so that an entry filled across a reload is already stale.
+    uint32_t load;
+    tc_config *view = storage_view_load(config, &load);
+
+    read_cache_entry *entry = &read_cache[hash & (TC_READ_CACHE_SIZE - 1)];
+    if (entry->config == config && entry->generation == generation && entry->resets == resets
+        && entry->load == load && entry->hash == hash && entry->key_length == key_length
+        && memcmp(entry->key, key, key_length) == 0)
+    {
+        *value = entry->value;
+        return entry->line;
+    }
+
+    size_t line = index_find_hash(view, key, key_length, hash);
+    if (line == LINE_NOT_FOUND) return LINE_NOT_FOUND;
+
+    value->ptr = line_value(view, line, &value->len);
+    if (key_length >= TC_LINE_MAX_SIZE) return line;
+
+    entry->config     = config;
+    entry->generation = generation;
+    entry->resets     = resets;
+    entry->load       = load;
+    entry->hash       = hash;
+    entry->key_length = key_length;
+    entry->line       = line;
+    entry->value      = *value;
+    memcpy(entry->key, key, key_length);
+    return line;
+}
+
+//---------------------------------------------------------------------------
+// Subscriptions
+//---------------------------------------------------------------------------
+
+/*
+    tc_subscribe registers a callback for a key. Each subscription remembers whether its key
+    existed and keeps a copy of its value when it was last notified, so after a load (or a
+    tc_set_value) the new value is found through the index and compared against it byte by byte,
+    and only the subscriptions whose value changed are called. The old line table isn't needed, which matters
+    as loads overwrite it in place. Callbacks run on the thread that loads or sets, never on the
+    readers.
+
+    Callbacks can unsubscribe, the one running included. While a notification runs
+    (subscription_depth isn't 0) tc_unsubscribe only marks the subscriptions as removed, and the
+    outermost notification frees them once every callback returned, so the keys given to the
+    callbacks stay valid and no subscription moves under the loop.
+
+    Writers notify after their config->sequence write, so that callbacks can read the config, and
+    two writers on different threads would otherwise notify at the same time and in any order. A
+    notification holds config->notifier (the id of its thread) for the whole pass, and each pass
+    compares against the values of the previous one and reads the current values: a writer that
+    notifies late finds the values of the later writes already notified and calls nothing, so the
+    callbacks see the values in generation order. A callback that writes the config notifies
+    inline, its thread already holds config->notifier.
+*/
+
+struct tc_subscription {
+    char        *key;
+    size_t       key_length;
+    uint32_t     key_hash;
+    tc_callback  callback;
+    void        *ctx;
+    bool         exists;
+    bool         removed;
+    char        *value;
+    size_t       value_length;
+    size_t       value_capacity;
+};
+
+/// Find the value of the subscribed key, without materializing lazy lines. NULL when the key
+/// doesn't exist.
+internal const char *subscription_value(
+    tc_config *config,
+    tc_subscription *subscription,
+    size_t *value_length
+) {
+    size_t line = index_find_hash(
+        config, subscription->key, subscription->key_length, subscription->key_hash
+    );
+    if (line == LINE_NOT_FOUND) return NULL;
+    return line_value_peek(config, line, value_length);
+}
+
+/// Update the subscription to the current value, return whether it changed.
+internal bool subscription_update(tc_config *config, tc_subscription *subscription)
+{
+    size_t value_length = 0;
+    const char *value = subscription_value(config, subscription, &value_length);
+    bool exists = value != NULL;
+
+    bool changed = exists != subscription->exists
+        || (exists && (value_length != subscription->value_length
+            || memcmp(value, subscription->value, value_length) != 0));
+    if (!changed || !exists)
+    {
+        subscription->exists = exists;
+        return changed;
+    }
+
+    if (value_length > subscription->value_capacity)
+    {
+        const tc_allocator *allocator = config_allocator(config);
+        char *copy = memory_alloc(allocator, value_length);
+        if (copy == NULL)
+        {
+            // Without a copy, the next value is compared as changed.
+            ERROR_REPORT("failed to allocate the value of the subscription to %s", subscription->key);
+            subscription->exists = false;
+            return changed;
+        }
+        memory_free(allocator, subscription->value, subscription->value_capacity);
+        subscription->value          = copy;
+        subscription->value_capacity = value_length;
+    }
+    if (value_length > 0) memcpy(subscription->value, value, value_length);
+    subscription->exists       = true;
+    subscription->value_length = value_length;
+    return changed;
+}
+
+internal void subscription_free(const tc_allocator *allocator, tc_subscription *subscription)
+{
+    memory_free(allocator, subscription->key, subscription->key_length + 1);
+    memory_free(allocator, subscription->value, subscription->value_capacity);
+}
+
+/// Free the subscriptions marked as removed and move the others to the front, in order.
+internal void subscriptions_compact(tc_config *config)
+{
+    const tc_allocator *allocator = config_allocator(config);
+    size_t kept = 0;
+    for (size_t i = 0; i < config->subscription_count; i++)
+    {
+        tc_subscription *subscription = &config->subscriptions[i];
+        if (subscription->removed)
+        {
+            subscription_free(allocator, subscription);
+            continue;
+        }
+        config->subscriptions[kept++] = *subscription;
+    }
+    config->subscription_count = kept;
+}
+
+internal uint32_t notifier_count = 0;
+internal TC_THREAD_LOCAL uint32_t notifier_id = 0;
+
+/// Take config->notifier for this thread, false when it already holds it.
+internal bool notifier_acquire(tc_config *config)
+{
+    if (notifier_id == 0) notifier_id = atomic_increment(&notifier_count);
+    if (atomic_load_acquire(&config->notifier) == notifier_id) return false;
+    while (!atomic_compare_exchange(&config->notifier, 0, notifier_id)) {}
+    return true;
+}
+
+/// Call the subscriptions whose value changed, only the ones of key_hash when it isn't 0.
+internal void subscriptions_notify(tc_config *config, uint32_t key_hash)
+{
+    if (config->subscription_count == 0) return;
+    bool outermost = notifier_acquire(config);
+
+    // Callbacks can subscribe, which may move the array, so it's read again on every iteration.
+    config->subscription_depth += 1;
+    for (size_t i = 0; i < config->subscription_count; i++)
+    {
+        tc_subscription *subscription = &config->subscriptions[i];
+        if (subscription->removed) continue;
+        if (key_hash != 0 && subscription->key_hash != key_hash) continue;
+        if (!subscription_update(config, subscription)) continue;
+
+        tc_str value = {0};
+        size_t line = index_find_hash(
+            config, subscription->key, subscription->key_length, subscription->key_hash
+        );
+        if (line != LINE_NOT_FOUND) value.ptr = line_value(config, line, &value.len);
+        subscription->callback(config, subscription->key, value, subscription->ctx);
+    }
+    config->subscription_depth -= 1;
+    if (config->subscription_depth == 0) subscriptions_compact(config);
+    if (outermost) atomic_store_release(&config->notifier, 0);
+}
+
+internal void subscriptions_free(tc_config *config)
+{
+    const tc_allocator *allocator = config_allocator(config);
+    for (size_t i = 0; i < config->subscription_count; i++)
+        subscription_free(allocator, &config->subscriptions[i]);
+    memory_free(
+        allocator, config->subscriptions, config->subscription_capacity * sizeof(tc_subscription)
+    );
+    config->subscriptions         = NULL;
+    config->subscription_count    = 0;
+    config->subscription_capacity = 0;
+}
+
+//---------------------------------------------------------------------------
+// Changes
+//---------------------------------------------------------------------------
+
+/*
+    A change of the value of a key, recorded away from the config by tc_queue_set_value and
+    tc_txn_set and written later by the thread that writes the config. The key is kept alongside
+    its hash instead of a line position, as lines move when the config is reloaded or its layout
+    is optimized in between.
+
+    A transaction (tc_txn) is an array of changes. tc_txn_commit finds the line of every change
+    first, so that a missing key fails the transaction before anything is written, copies the
+    chunks shared with snapshots (the only allocations of a commit), and then writes them all under
+    one config->sequence write with one generation bump. The lines are written in place, so only
+    readers under the sequence see either none or all of the changes: tc_get_values_copy reads
+    many keys at once and retries across the write, like tc_get_value_copy does for one key. A
+    tc_get_value on another thread can see a part of the commit. The commit costs one lookup and
+    one copy per changed key.
+*/
+
+struct tc_change {
+    uint32_t hash;
+    uint32_t key_length;
+    uint32_t value_length;
+    // The key followed by the value, without separator nor terminators.
+    char     text[TC_LINE_MAX_SIZE];
+};
+
+/// Whether a line with the key and value fits in TC_LINE_MAX_SIZE, +2 for '=' and '\0'.
+internal bool change_fits(size_t key_length, size_t value_length)
+{
+    return key_length + value_length + 2 <= TC_LINE_MAX_SIZE;
+}
+
+internal void change_init(
+    tc_change *change,
+    const char *key,
+    size_t key_length,
+    uint32_t hash,
+    const char *new_value,
+    size_t new_value_length
+) {
+    change->hash         = hash;
+    change->key_length   = (uint32_t) key_length;
+    change->value_length = (uint32_t) new_value_length;
+    memcpy(change->text, key, key_length);
+    memcpy(&change->text[key_length], new_value, new_value_length);
+}
+
+internal size_t change_line(tc_config *config, const tc_change *change)
+{
+    return index_find_hash(config, change->text, change->key_length, change->hash);
+}
+
+/// Write the change to its line, called by writers under config->sequence.
+internal bool change_write(tc_config *config, size_t line, const tc_change *change, uint32_t generation)
+{
+    if (!line_value_write(config, line, &change->text[change->key_length], change->value_length))
+        return false;
+    generation_line_set(config, line, generation);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Pending sets
+//---------------------------------------------------------------------------
+
+/*
+    tc_queue_set_value lets any thread request a change that the thread owning the config applies
+    later with tc_apply_pending. The queue is a bounded ring of slots with a sequence number each
+    (Dmitry Vyukov's bounded queue): a producer claims the slot at tail with a compare exchange,
+    copies the key and value into it and publishes it by setting its sequence to position + 1.
+    The single consumer takes the slots in order while their sequence says they're published and
+    sets it to position + capacity, which makes the slot free for the next lap. Producers never
+    block, they only retry the compare exchange when another producer claimed the same slot and a
+    full queue fails right away. The consumer stops at a slot that is claimed but not yet
+    published, it's taken by the next apply.
+*/
+
+typedef struct {
+    uint32_t  sequence;
+    tc_change change;
+} pending_set;
+
+struct tc_pending {
+    uint32_t    tail;
+    // Producers write tail, keep the consumer position on another cache line.
+    char        padding[64 - sizeof(uint32_t)];
+    uint32_t    head;
+    uint32_t    mask;
+    pending_set slots[];
+};
+
+internal size_t pending_size(size_t capacity)
+{
+    return sizeof(tc_pending) + capacity * sizeof(pending_set);
+}
+
+internal void pending_free(tc_config *config)
+{
+    if (config->pending == NULL) return;
+    memory_free(config_allocator(config), config->pending, pending_size(config->pending->mask + 1));
+    config->pending = NULL;
+}
+
+/// Claim a slot for a producer, NULL when the queue is full.
+internal pending_set *pending_claim(tc_pending *pending, uint32_t *position)
+{
+    for (;;)
+    {
+        uint32_t tail = atomic_load_acquire(&pending->tail);
+        pending_set *slot = &pending->slots[tail & pending->mask];
+        int32_t distance = (int32_t) (atomic_load_acquire(&slot->sequence) - tail);
+
+        // The consumer didn't free the slot of the previous lap yet.
+        if (distance < 0) return NULL;
+        if (distance == 0 && atomic_compare_exchange(&pending->tail, tail, tail + 1))
+        {
+            *position = tail;
+            return slot;
+        }
+    }
+}
+
+/// Take the next published slot for the consumer, NULL when there is none.
+internal pending_set *pending_take(tc_pending *pending)
+{
+    pending_set *slot = &pending->slots[pending->head & pending->mask];
+    if (atomic_load_acquire(&slot->sequence) != pending->head + 1) return NULL;
+    return slot;
+}
+
+/// Give the slot taken by pending_take back to the producers.
+internal void pending_release(tc_pending *pending, pending_set *slot)
+{
+    atomic_store_release(&slot->sequence, pending->head + pending->mask + 1);
+    pending->head += 1;
+}
+
+//---------------------------------------------------------------------------
+// Staged reload
+//---------------------------------------------------------------------------
+
+/*
+    tc_load_config parses in place, so an error found halfway through the file leaves the config
+    with the first lines of the new file. tc_reload_staged parses the file into a staging config
+    instead, with storage of its own (TC_OWNED, or chunks for TC_GROW) and the options of the live
+    config, and the validator of the caller reads it like any other config. Only then the storage
+    of the staging config is swapped into the live config, under config->sequence so that
+    tc_get_value_copy sees either config but never a mix of both, and the storage of the previous
+    load is retired, see "Epochs". Readers find the storage through the record published with it,
+    see "Storage records". When anything fails the staging config is released and the live config is
+    never touched.
+
+    The staging config borrows the scratch buffer of the live config, unless the live source lives
+    in it (a borrowed scratch buffer of a TC_LAZY or TC_VIEW config), and gives it back afterwards.
+*/
+
+internal bool staging_lends_scratch(tc_config *config)
+{
+    return !(config->scratch.borrowed && config->source == config->scratch.data);
+}
+
+/// Start a staging config with the options of config, the layout of config->profile is applied
+/// to it, access counts and generations are kept by the live config.
+internal tc_config staging_init(tc_config *config, bool lent)
+{
+    tc_config staged = {
+        .flags     = config->flags & (TC_LAZY | TC_VIEW | TC_PARALLEL | TC_GROW),
+        .allocator = config->allocator,
+        .profile   = config->profile,
+    };
+    if (lent)
+    {
+        staged.scratch  = config->scratch;
+        config->scratch = (tc_scratch) {0};
+    }
+    return staged;
+}
+
+/// Give the lent scratch buffer back to config. TC_LAZY and TC_VIEW staging configs keep the file
+/// as their source and leave an empty scratch buffer, spare (a source that is no longer needed)
+/// becomes the scratch buffer then. Return whether spare was taken.
+internal bool staging_scratch_return(tc_config *config, tc_config *staged, char *spare, size_t spare_capacity)
+{
+    config->scratch = staged->scratch;
+    staged->scratch = (tc_scratch) {0};
+    if (config->scratch.data != NULL || spare == NULL) return false;
+
+    config->scratch = (tc_scratch) { .data = spare, .capacity = spare_capacity };
+    return true;
+}
+
+/// Give the staging config zeroed access counts when config counts reads, they replace the counts
+/// of config alongside its storage.
+internal bool staging_counts(tc_config *config, tc_config *staged)
+{
+    if (!(config->flags & TC_PROFILE)) return true;
+
+    staged->flags |= TC_PROFILE;
+    return access_counts_reset(staged);
+}
+
+/// Release the staging config, the live config gets its scratch buffer back.
+internal void staging_abort(tc_config *config, tc_config *staged, bool lent)
+{
+    if (lent && staging_scratch_return(config, staged, staged->source, staged->source_capacity))
+        staged->source = NULL;
+
+    // A borrowed scratch buffer holds the source of the staging config.
+    if (lent && staged->source == config->scratch.data)
+        staged->source = NULL;
+    tc_free_config(staged);
+}
+
+/// Retire the storage of the previous load, tc_get_value_copy and the readers between
+/// tc_read_enter and tc_read_leave may still be in it. The index and source shared with
+/// snapshots stay with them.
+internal void staging_retire(tc_config *previous)
+{
+    const tc_allocator *allocator = config_allocator(previous);
+    epoch_retire(shared_release_retired, allocator, shared_forget(previous), 0);
+
+    if (previous->flags & TC_OWNED)
+    {
+        if (previous->chunks != NULL)
+        {
+            epoch_retire(chunk_table_release_retired, allocator, previous->chunks, previous->chunk_count);
+        }
+        else
+        {
+            // The line buffer always has half as many lines as index entries.
+            size_t buffer_size = previous->index_size / 2 * TC_LINE_TOTAL_SIZE;
+            epoch_retire(memory_free, allocator, previous->buffer, buffer_size);
+        }
+        epoch_retire(memory_free, allocator, previous->index, previous->index_size * sizeof(tc_index_entry));
+    }
+    epoch_retire(memory_free, allocator, previous->source, previous->source_capacity);
+    epoch_retire(memory_free, allocator, previous->access_counts, previous->access_capacity * sizeof(uint32_t));
+}
+
+/// Swap the storage of the staging config into config, publish it in storage and retire the
+/// storage of the previous load.
+internal void staging_commit(tc_config *config, tc_config *staged, bool lent, tc_storage *storage)
+{
+    tc_config previous = {
+        .buffer          = config->buffer,
+        .index           = config->index,
+        .index_size      = config->index_size,
+        .flags           = config->flags & TC_OWNED,
+        .source          = config->source,
+        .source_capacity = config->source_capacity,
+        .allocator       = config->allocator,
+        .chunks          = config->chunks,
+        .chunk_count     = config->chunk_count,
+        .shared          = config->shared,
+        .access_counts   = config->access_counts,
+        .access_capacity = config->access_capacity,
+    };
+
+    sequence_write_begin(config);
+    config->buffer          = staged->buffer;
+    config->size            = staged->size;
+    config->index           = staged->index;
+    config->index_size      = staged->index_size;
+    config->source          = staged->source;
+    config->source_capacity = staged->source_capacity;
+    config->chunks          = staged->chunks;
+    config->chunk_count     = staged->chunk_count;
+    config->shared          = NULL;
+    config->access_counts   = staged->access_counts;
+    config->access_capacity = staged->access_capacity;
+    config->flags           = (config->flags & ~TC_OWNED) | (staged->flags & TC_OWNED);
+
+    // The previous source isn't reused as the scratch buffer, readers may still be in it. The
+    // scratch buffer is back before the record is filled, the source can live in it.
+    if (lent) staging_scratch_return(config, staged, NULL, 0);
+    storage_publish(config, storage);
+    sequence_write_end(config);
+
+    if (!lent)
+    {
+        // The previous source lives in the borrowed scratch buffer, which config keeps.
+        memory_free(config_allocator(config), staged->scratch.data, staged->scratch.capacity);
+        previous.source = NULL;
+    }
+    staging_retire(&previous);
+}
+
+//---------------------------------------------------------------------------
+// Snapshots
+//---------------------------------------------------------------------------
+
+/*
+    tc_snapshot returns a read only config sharing the storage of a TC_GROW config as it is: the
+    chunk table and the chunks through their reference counts, the index and the source through
+    a tc_shared record, see "Growable storage". Taking a snapshot copies nothing but the tc_config
+    itself, whatever the size of the config. Afterwards the config copies a chunk before writing
+    to it while it's shared (and the chunk table the first time), so a tc_set_value costs one
+    chunk of TC_GROW_CHUNK_LINES lines at most, and a load starts over with storage of its own.
+
+    Snapshots never write to their lines, so the lines of a TC_LAZY config that weren't read yet
+    are moved into their slots when the first snapshot is taken. Any thread can then read a
+    snapshot and release it, the reference counts are atomic.
+*/
+
+typedef struct {
+    tc_config config;
+    uint32_t  references;
+} config_snapshot;
+
+//---------------------------------------------------------------------------
+// tinyconfig.h
+//---------------------------------------------------------------------------
+
+internal void *buffer[TC_CONFIG_MAX_SIZE * TC_LINE_TOTAL_SIZE] = {0};
+internal tc_index_entry index_buffer[TC_INDEX_SIZE] = {0};
+
+_Static_assert(TC_INDEX_SIZE > TC_CONFIG_MAX_SIZE, "TC_INDEX_SIZE must be bigger than TC_CONFIG_MAX_SIZE");
+
+/// Load the file that config_read put in the scratch buffer. The fingerprint is cleared, the
+/// caller records the one of the file when it has it.
+internal bool config_load_file(tc_config *config, size_t bytes_read)
+{
+    // The previous source is released only now, source lines of the old config point inside of it.
+    char *file_buffer = config_file_take(config);
+
+    if (config->flags & TC_GROW)
+    {
+        config_grow_prepare(config);
+    }
+    else
+    {
+        config_owned_free(config);
+        config->buffer     = buffer;
+        config->size       = 0;
+        config->index      = index_buffer;
+        config->index_size = TC_INDEX_SIZE;
+        memset(index_buffer, 0, sizeof(index_buffer));
+    }
+    bool success = tc_parse_config(config, file_buffer, bytes_read);
+    if (!success)
+        config->size = 0;
+    config->fingerprint = (tc_fingerprint) {0};
+    success = generation_loaded(config) && success;
+    success = storage_reset(config) && success;
+    subscriptions_notify(config, 0);
+    return success;
+}
+
+extern bool tc_load_config(tc_config *config, const char *file_path)
+{
+    assert(config != NULL);
+#ifndef NDEBUG
+    double startTime = (double) clock() / CLOCKS_PER_SEC;
+#endif
+
+    size_t bytes_read;
+    if (!config_read(config, file_path, &bytes_read))
+        return false;
+
+    bool success = config_load_file(config, bytes_read);
+#ifndef NDEBUG
+    double elapsed = (double)clock() / CLOCKS_PER_SEC - startTime;
+    printf("tinyconfig: load config time: %f seconds\n", elapsed);
+    printf("tinyconfig: configuration buffer size: %zi bytes\n", TC_CONFIG_MAX_SIZE * TC_LINE_TOTAL_SIZE);
 #endif
 
-    FILE *file;
-    bool ok = open_file(&file, file_path, "rb");
-    if (!ok)
+    return success;
+}
+
+/// Load the file only when it changed since the last load of the config, see "Fingerprints". The
+/// stat of the file is compared first and the file is read and hashed only when it differs, the
+/// file is parsed only when its content differs. tc_generation tells whether it was loaded.
+extern bool tc_reload_if_changed(tc_config *config, const char *file_path)
+{
+    assert(config != NULL);
+
+    tc_fingerprint current = {0};
+    fingerprint_stat(file_path, &current);
+    if (fingerprint_stat_equal(&current, &config->fingerprint)) return true;
+
+    // Reading into a borrowed scratch buffer overwrites the source of the config.
+    bool source_lost = config->scratch.borrowed && config->source == config->scratch.data;
+
+    size_t bytes_read;
+    if (!config_read(config, file_path, &bytes_read))
+        return false;
+
+    uint64_t hash = content_hash(config->scratch.data, bytes_read);
+    if (!source_lost && config->fingerprint.has_hash && config->fingerprint.content_hash == hash)
+    {
+        current.content_hash = hash;
+        current.has_hash     = true;
+        config->fingerprint  = current;
+        return true;
+    }
+
+    bool success = config_load_file(config, bytes_read);
+    if (success)
+    {
+        current.content_hash = hash;
+        current.has_hash     = true;
+        config->fingerprint  = current;
+    }
+    return success;
+}
+
+/// Load the file into a staging config and call validate on it (when it isn't NULL), see "Staged
+/// reload". The config is replaced only when both succeed, otherwise false is returned, the config
+/// is left as it was and error (when it isn't NULL) says what failed.
+extern bool tc_reload_staged(
+    tc_config *config,
+    const char *file_path,
+    tc_validator validate,
+    void *ctx,
+    tc_error *error
+) {
+    assert(config != NULL);
+    tc_error ignored;
+    if (error == NULL) error = &ignored;
+    *error = (tc_error) {0};
+
+    tc_fingerprint current = {0};
+    fingerprint_stat(file_path, &current);
+
+    bool lent = staging_lends_scratch(config);
+    tc_config staged = staging_init(config, lent);
+
+    tc_error *previous_sink = error_sink;
+    error_sink = error;
+    size_t bytes_read;
+    if (!config_read(&staged, file_path, &bytes_read))
+    {
+        error->kind = TC_ERROR_READ;
+    }
+    else
+    {
+        current.content_hash = content_hash(staged.scratch.data, bytes_read);
+        current.has_hash     = true;
+        if (!config_owned_parse(&staged, bytes_read)) error->kind = TC_ERROR_PARSE;
+    }
+    error_sink = previous_sink;
+
+    if (error->kind == TC_ERROR_NONE && validate != NULL && !validate(&staged, ctx, error))
+        error->kind = TC_ERROR_VALIDATION;
+
+    // Allocated before the commit, which can't fail once it started.
+    tc_storage *storage = NULL;
+    if (error->kind == TC_ERROR_NONE
+        && (!staging_counts(config, &staged) || (storage = storage_next(config)) == NULL))
+    {
+        error->kind = TC_ERROR_MEMORY;
+    }
+
+    if (error->kind != TC_ERROR_NONE)
+    {
+        if (error->message[0] == '\0')
+        {
+            const char *reason = error->kind == TC_ERROR_READ ? "failed to read"
+                : error->kind == TC_ERROR_PARSE ? "failed to parse"
+                : error->kind == TC_ERROR_MEMORY ? "failed to allocate the storage of"
+                : "validation failed for";
+            snprintf(error->message, sizeof(error->message), "%s %s", reason, file_path);
+        }
+        staging_abort(config, &staged, lent);
         return false;
+    }
 
-    TC_FSEEK(file, 0L, SEEK_END);
-    size_t file_size = TC_FTELL(file);
-    rewind(file);
+    staging_commit(config, &staged, lent, storage);
+    config->fingerprint = current;
+    bool success = generation_loaded(config);
+    if (!success)
+    {
+        error->kind = TC_ERROR_MEMORY;
+        snprintf(error->message, sizeof(error->message), "failed to allocate the generations of %s", file_path);
+    }
+    subscriptions_notify(config, 0);
+    return success;
+}
 
-    char *file_buffer = malloc(file_size + 1);
-    if (!file_buffer)
+/// Load every file of directory whose name matches the fnmatch pattern (every file when pattern is
+/// NULL) into one config, see "Directories" for the merge rules. The files are read and parsed
+/// concurrently. A directory without matching files results in an empty config, a single file
+/// that fails to load fails the whole config.
+extern bool tc_load_directory(tc_config *config, const char *directory, const char *pattern)
+{
+    assert(config != NULL);
+    assert(directory != NULL);
+
+    path_list list = {0};
+    if (!directory_list(directory, pattern, &list))
     {
-        free(file_buffer);
+        ERROR_REPORT("failed to list the directory %s", directory);
         return false;
     }
 
-    size_t bytes_read = fread(file_buffer, sizeof(char), file_size, file);
-    if (bytes_read == 0)
+    size_t count = list.count;
+    directory_file *files = memory_calloc(global_allocator, count > 0 ? count : 1, sizeof(directory_file));
+    if (files == NULL)
     {
-        free(file_buffer);
+        path_list_free(&list);
         return false;
     }
+    for (size_t i = 0; i < count; i++)
+    {
+        files[i].path         = list.paths[i];
+        files[i].config.flags = config->flags & TC_GROW;
+    }
 
-    file_buffer[bytes_read] = '\0';
-    fclose(file);
+    size_t threads = thread_count();
+    if (threads > count) threads = count;
+    directory_worker workers[TC_PARALLEL_MAX_THREADS];
+    for (size_t i = 0; i < threads; i++)
+        workers[i] = (directory_worker) { .files = files, .count = count, .first = i, .step = threads };
+    threads_run(directory_worker_run, workers, sizeof(directory_worker), threads);
+    for (size_t i = 0; i < threads; i++)
+        memory_free(global_allocator, workers[i].scratch.data, workers[i].scratch.capacity);
 
-    config->buffer = buffer;
-    config->size   = 0;
-    bool success   = tc_parse_config(config, file_buffer, bytes_read);
-#ifndef NDEBUG
-    double elapsed = (double)clock() / CLOCKS_PER_SEC - startTime;
-    printf("tinyconfig: load config time: %f seconds\n", elapsed);
-    printf("tinyconfig: configuration buffer size: %zi bytes\n", TC_CONFIG_MAX_SIZE * TC_LINE_TOTAL_SIZE);
+    bool success = true;
+    for (size_t i = 0; i < count && success; i++)
+    {
+        if (!files[i].success)
+        {
+            ERROR_REPORT("failed to load %s", files[i].path);
+            success = false;
+        }
+    }
+
+    config_source_free(config);
+    if (config->flags & TC_GROW)
+    {
+        config_grow_prepare(config);
+    }
+    else
+    {
+        config_owned_free(config);
+        config->buffer     = buffer;
+        config->size       = 0;
+        config->index      = index_buffer;
+        config->index_size = TC_INDEX_SIZE;
+        memset(index_buffer, 0, sizeof(index_buffer));
+    }
+    if (success)
+        success = directory_merge(config, files, count) && layout_loaded(config);
+    if (!success)
+        config->size = 0;
+    config->fingerprint = (tc_fingerprint) {0};
+    success = generation_loaded(config) && success;
+    success = storage_reset(config) && success;
+    subscriptions_notify(config, 0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        memory_free(global_allocator, files[i].config.buffer, files[i].capacity * TC_LINE_TOTAL_SIZE);
+        memory_free(global_allocator, files[i].hashes, files[i].capacity * sizeof(uint32_t));
+        config_owned_free(&files[i].config);
+    }
+    memory_free(global_allocator, files, (count > 0 ? count : 1) * sizeof(directory_file));
+    path_list_free(&list);
+    return success;
+}
+
+/// Load each file of file_paths into the config at the same position of configs, see "Batch
+/// loading". Every config gets a line buffer and an index of its own, which tc_free_config
+/// releases. False is returned when any file fails, a config whose file can't be read is left
+/// as it was and one that fails to parse is left empty.
+extern bool tc_load_configs(tc_config *configs, const char *const *file_paths, size_t count)
+{
+    assert(configs != NULL || count == 0);
+    if (count == 0) return true;
+
+    bool *loaded = memory_calloc(global_allocator, count, sizeof(bool));
+    if (loaded == NULL) return false;
+
+    bool fallback = true;
+#ifdef TC_IO_URING
+    uring ring;
+    unsigned int entries = count * 2 < TC_IO_URING_ENTRIES ? (unsigned int) count * 2 : TC_IO_URING_ENTRIES;
+    if (uring_open(&ring, entries))
+    {
+        fallback = !batch_load_uring(&ring, configs, file_paths, loaded, count);
+        uring_close(&ring);
+    }
 #endif
+    if (fallback)
+        batch_load_threads(configs, file_paths, loaded, count);
+
+    bool success = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        configs[i].fingerprint = (tc_fingerprint) {0};
+        if (!generation_loaded(&configs[i])) loaded[i] = false;
+        if (!storage_reset(&configs[i])) loaded[i] = false;
+        subscriptions_notify(&configs[i], 0);
+        if (loaded[i]) continue;
+        ERROR_REPORT("failed to load %s", file_paths[i]);
+        success = false;
+    }
 
+    memory_free(global_allocator, loaded, count * sizeof(bool));
     return success;
 }
 
-/// Iterates config->buffer to find the correct key and return its value.
+/// Looks up the key in config->index and return its value.
 extern char *tc_get_value(tc_config *config, const char *key)
 {
-    for (size_t i = 0; i < config->size; i += 1)
+    if (config->flags & TC_READ_CACHE) return (char *) tc_get_value_sv(config, key).ptr;
+
+    tc_config *view = storage_view(config);
+    size_t line = index_find(view, key);
+    if (line == LINE_NOT_FOUND) return NULL;
+
+    line_count_access(view, line);
+    size_t value_length;
+    return line_value(view, line, &value_length);
+}
+
+/// Same as tc_get_value, but the value length is returned alongside it, the length is stored in
+/// the line header so no strlen is needed.
+extern tc_str tc_get_value_sv(tc_config *config, const char *key)
+{
+    tc_str value = {0};
+    if (config->flags & TC_READ_CACHE)
     {
-        size_t offset = line_offset_get(config, i);
-        char *key_start = header_read(line_get(config, i));
-        if (key_compare(key, offset - 1, key_start))
+        size_t line = read_cache_find(config, key, &value);
+        if (line != LINE_NOT_FOUND) line_count_access(storage_view(config), line);
+        return value;
+    }
+
+    tc_config *view = storage_view(config);
+    size_t line = index_find(view, key);
+    if (line == LINE_NOT_FOUND) return value;
+
+    line_count_access(view, line);
+    value.ptr = line_value(view, line, &value.len);
+    return value;
+}
+
+/// Copy the value of the key and a null terminator into buffer, and return it alongside its
+/// length. Unlike tc_get_value it never writes to the config and retries when tc_set_value
+/// changes the value meanwhile, so it can run on any thread while another one sets values. ptr
+/// is NULL when the key doesn't exist or the value doesn't fit in capacity bytes.
+extern tc_str tc_get_value_copy(tc_config *config, const char *key, char *buffer, size_t capacity)
+{
+    size_t key_length;
+    uint32_t hash = key_hash_null(key, &key_length);
+
+    // The storage replaced by tc_reload_staged is kept until the copy is done.
+    tc_read_enter();
+    for (;;)
+    {
+        uint32_t sequence = sequence_read_begin(config);
+        tc_config *view = storage_view(config);
+
+        size_t value_length = 0;
+        size_t line = index_find_hash(view, key, key_length, hash);
+        if (line != LINE_NOT_FOUND)
         {
-            return &key_start[offset];
+            const char *value = line_value_peek(view, line, &value_length);
+            if (value_length < capacity) memcpy(buffer, value, value_length);
         }
+
+        if (sequence_read_retry(config, sequence)) continue;
+        if (line != LINE_NOT_FOUND && value_length < capacity) line_count_access(view, line);
+        tc_read_leave();
+
+        tc_str copy = {0};
+        if (line == LINE_NOT_FOUND || value_length >= capacity) return copy;
+
+        buffer[value_length] = '\0';
+        copy.ptr = buffer;
+        copy.len = value_length;
+        return copy;
     }
+}
 
-    return NULL;
+/// Copy the values of count keys into buffer, one after the other with their null terminators,
+/// and set values to them. All of them are read from the same state of the config, retrying when
+/// a tc_set_value, tc_txn_commit or reload changes it meanwhile, so a transaction is seen whole
+/// or not at all. The ptr of a value is NULL when its key doesn't exist or the value doesn't fit
+/// in the rest of buffer. Return the amount of values copied.
+extern size_t tc_get_values_copy(
+    tc_config *config,
+    const char *const *keys,
+    tc_str *values,
+    size_t count,
+    char *buffer,
+    size_t capacity
+) {
+    tc_read_enter();
+    for (;;)
+    {
+        uint32_t sequence = sequence_read_begin(config);
+        tc_config *view = storage_view(config);
+
+        size_t used = 0;
+        size_t copied = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t key_length;
+            uint32_t hash = key_hash_null(keys[i], &key_length);
+            values[i] = (tc_str) {0};
+
+            size_t line = index_find_hash(view, keys[i], key_length, hash);
+            if (line == LINE_NOT_FOUND) continue;
+
+            size_t value_length;
+            const char *value = line_value_peek(view, line, &value_length);
+            if (value_length >= capacity - used) continue;
+
+            memcpy(&buffer[used], value, value_length);
+            values[i] = (tc_str) { &buffer[used], value_length };
+            used   += value_length + 1;
+            copied += 1;
+        }
+
+        if (sequence_read_retry(config, sequence)) continue;
+        tc_read_leave();
+
+        // Terminated once the copies are known to be whole.
+        for (size_t i = 0; i < count; i++)
+        {
+            if (values[i].ptr != NULL) buffer[(values[i].ptr - buffer) + values[i].len] = '\0';
+        }
+        return copied;
+    }
+}
+
+/// Enter a read critical section on this thread, see "Epochs". Until the matching tc_read_leave,
+/// the storage that tc_reload_staged and tc_set_value replace meanwhile isn't released, so the
+/// values returned by tc_get_value and tc_get_value_sv stay readable. Each lookup reads one load
+/// through its storage record, two lookups can read two loads. Sections can be nested, and
+/// neither call waits for other threads.
+extern void tc_read_enter(void)
+{
+    if (reader_depth++ > 0) return;
+    if (reader == NULL) reader = reader_slot_claim();
+
+    if (reader != NULL)
+    {
+        uint32_t epoch = atomic_load_acquire(&epoch_global);
+        atomic_store_release(&reader->state, (epoch << 1) | 1);
+    }
+    else
+    {
+        atomic_increment(&readers_unregistered);
+    }
+    // The epoch must be visible before the config is read.
+    atomic_fence_full();
+}
+
+extern void tc_read_leave(void)
+{
+    assert(reader_depth > 0);
+    if (--reader_depth > 0) return;
+
+    if (reader != NULL) atomic_store_release(&reader->state, 0);
+    else atomic_decrement(&readers_unregistered);
+}
+
+/// Release the retired storage that no reader can hold anymore, and return how many blocks are
+/// still retired. It's also done every TC_RETIRE_BATCH retired blocks.
+extern size_t tc_reclaim(void)
+{
+    retire_lock_acquire();
+    // A block is released two epochs after it was retired.
+    for (int advances = 0; advances < 2; advances++)
+        epoch_reclaim();
+
+    size_t count = retired_count;
+    if (count == 0)
+    {
+        memory_free(retired_allocator, retired_blocks, retired_capacity * sizeof(retired_block));
+        retired_blocks   = NULL;
+        retired_capacity = 0;
+    }
+    retire_lock_release();
+    return count;
 }
 
-/// Iterates config->buffer to find the key and assign it a new value.
+/// Return the generation of the config, which is bumped by every load and tc_set_value. It's a
+/// single atomic load, so caches of derived values can be revalidated with one comparison. The
+/// generation is 0 until the first load.
+extern uint32_t tc_generation(tc_config *config)
+{
+    return atomic_load_acquire(&config->generation);
+}
+
+/// Return the generation at which the value of the key last changed, or 0 when the key doesn't
+/// exist. Configs without TC_LINE_GENERATIONS return the generation of the config.
+extern uint32_t tc_key_generation(tc_config *config, const char *key)
+{
+    size_t line = index_find(storage_view(config), key);
+    if (line == LINE_NOT_FOUND) return 0;
+    if (line >= config->line_generations_capacity) return tc_generation(config);
+    return atomic_load_acquire(&config->line_generations[line]);
+}
+
+/// Looks up the key in config->index and assign it a new value.
 /// If the new value overflows TC_LINE_MAX_SIZE or the provided key doesn't exist, NULL is
 /// returned to indicate failure. If the operation if successful a pointer to the value location
-/// is returned.
+/// is returned. Values are written under config->sequence, so other threads can read them with
+/// tc_get_value_copy meanwhile.
 extern char *tc_set_value(tc_config *config, char *key, char *new_value)
 {
+    assert(!(config->flags & TC_SNAPSHOT));
     size_t new_value_length = strlen(new_value);
     assert(new_value_length > 0);
 
-    size_t key_length = strlen(key);
+    size_t key_length;
+    uint32_t hash = key_hash_null(key, &key_length);
     assert(key_length > 0);
 
     // +2 for '=' and '\0'
@@ -436,24 +4550,432 @@ extern char *tc_set_value(tc_config *config, char *key, char *new_value)
         return NULL;
     }
 
-    for (size_t i = 0; i < config->size; i += 1)
+    size_t line = index_find_hash(config, key, key_length, hash);
+    if (line == LINE_NOT_FOUND) return NULL;
+
+    sequence_write_begin(config);
+    bool written = line_value_write(config, line, new_value, new_value_length);
+    if (written) generation_line_changed(config, line);
+    sequence_write_end(config);
+    if (!written) return NULL;
+
+    subscriptions_notify(config, hash);
+    return &header_read(line_get(config, line))[line_offset_get(config, line)];
+}
+
+/// Make room for capacity (rounded up to a power of two) sets queued by tc_queue_set_value, the
+/// sets still queued are dropped. It must be called before other threads queue sets.
+extern bool tc_reserve_pending(tc_config *config, size_t capacity)
+{
+    size_t rounded = 2;
+    while (rounded < capacity && rounded <= UINT32_MAX / 4) rounded *= 2;
+
+    pending_free(config);
+    tc_pending *pending = memory_alloc(config_allocator(config), pending_size(rounded));
+    if (pending == NULL) return false;
+
+    pending->tail = 0;
+    pending->head = 0;
+    pending->mask = (uint32_t) rounded - 1;
+    for (size_t i = 0; i < rounded; i++)
+        pending->slots[i].sequence = (uint32_t) i;
+    config->pending = pending;
+    return true;
+}
+
+/// Queue a change of the value of the key for the next tc_apply_pending, see "Pending sets". It
+/// can be called from any thread and never blocks, false is returned when the queue is full (or
+/// wasn't reserved) or the line would overflow TC_LINE_MAX_SIZE.
+extern bool tc_queue_set_value(tc_config *config, const char *key, const char *new_value)
+{
+    size_t new_value_length = strlen(new_value);
+    assert(new_value_length > 0);
+
+    size_t key_length;
+    uint32_t hash = key_hash_null(key, &key_length);
+    assert(key_length > 0);
+
+    if (config->pending == NULL || !change_fits(key_length, new_value_length))
+        return false;
+
+    uint32_t position;
+    pending_set *slot = pending_claim(config->pending, &position);
+    if (slot == NULL) return false;
+
+    change_init(&slot->change, key, key_length, hash, new_value, new_value_length);
+    atomic_store_release(&slot->sequence, position + 1);
+    return true;
+}
+
+/// Apply the sets queued by tc_queue_set_value, in the order they were queued, and return how many
+/// changed a value (sets of keys that don't exist are dropped). It must run on the thread that
+/// owns the config. The sets are written under a single config->sequence write, so
+/// tc_get_value_copy sees all of them or none, and bump the generation once. A set that can't be
+/// written (memory ran out copying a chunk shared with a snapshot) stops the apply and stays
+/// queued with the ones after it, the next tc_apply_pending tries it again.
+extern size_t tc_apply_pending(tc_config *config)
+{
+    tc_pending *pending = config->pending;
+    if (pending == NULL || pending_take(pending) == NULL) return 0;
+
+    size_t applied = 0;
+    sequence_write_begin(config);
+    uint32_t generation = config->generation + 1;
+    for (pending_set *slot = pending_take(pending); slot != NULL; slot = pending_take(pending))
+    {
+        size_t line = change_line(config, &slot->change);
+        if (line != LINE_NOT_FOUND)
+        {
+            if (!change_write(config, line, &slot->change, generation))
+            {
+                ERROR_REPORT(
+                    "failed to apply the pending set of %.*s, it stays queued",
+                    (int) slot->change.key_length, slot->change.text
+                );
+                break;
+            }
+            applied += 1;
+        }
+        pending_release(pending, slot);
+    }
+    if (applied > 0) generation_bump(config);
+    sequence_write_end(config);
+
+    if (applied > 0) subscriptions_notify(config, 0);
+    return applied;
+}
+
+/// Start a transaction on the config, see "Changes". Its changes are recorded
+/// by tc_txn_set without touching the config, so it can be built on any thread.
+extern void tc_txn_begin(tc_config *config, tc_txn *txn)
+{
+    *txn = (tc_txn) { .config = config };
+}
+
+/// Record a change of the value of the key, written by tc_txn_commit. When the line would
+/// overflow TC_LINE_MAX_SIZE, or memory runs out, false is returned and the transaction fails
+/// as a whole.
+extern bool tc_txn_set(tc_txn *txn, const char *key, const char *new_value)
+{
+    size_t new_value_length = strlen(new_value);
+    assert(new_value_length > 0);
+
+    size_t key_length;
+    uint32_t hash = key_hash_null(key, &key_length);
+    assert(key_length > 0);
+
+    if (txn->failed || !change_fits(key_length, new_value_length))
+    {
+        txn->failed = true;
+        return false;
+    }
+
+    if (txn->count == txn->capacity)
+    {
+        size_t capacity = txn->capacity > 0 ? txn->capacity * 2 : 4;
+        tc_change *changes = memory_grow(
+            config_allocator(txn->config),
+            txn->changes,
+            txn->capacity * sizeof(tc_change),
+            capacity * sizeof(tc_change)
+        );
+        if (changes == NULL)
+        {
+            txn->failed = true;
+            return false;
+        }
+        txn->changes  = changes;
+        txn->capacity = capacity;
+    }
+
+    change_init(&txn->changes[txn->count++], key, key_length, hash, new_value, new_value_length);
+    return true;
+}
+
+/// Release the changes of the transaction without writing them.
+extern void tc_txn_abort(tc_txn *txn)
+{
+    if (txn->changes != NULL)
+        memory_free(config_allocator(txn->config), txn->changes, txn->capacity * sizeof(tc_change));
+    *txn = (tc_txn) {0};
+}
+
+/// Write every change of the transaction, in the order they were set, or none of them when a
+/// tc_txn_set failed or a key doesn't exist. The changes are written under a single
+/// config->sequence write and bump the generation once, so readers that check tc_generation (or
+/// tc_get_value_copy) never see part of them. The transaction is released either way, and like
+/// tc_set_value it must not run while another thread writes the config.
+extern bool tc_txn_commit(tc_txn *txn)
+{
+    tc_config *config = txn->config;
+    bool success = !txn->failed;
+    for (size_t i = 0; i < txn->count && success; i++)
+        success = change_line(config, &txn->changes[i]) != LINE_NOT_FOUND;
+
+    if (success && txn->count > 0)
+    {
+        sequence_write_begin(config);
+        // Chunks shared with snapshots are copied before anything is written.
+        for (size_t i = 0; i < txn->count && success; i++)
+            success = chunk_unshare(config, change_line(config, &txn->changes[i]));
+
+        // Nothing left to allocate once the chunks are copied, a failed write stops the commit
+        // but what was written is still published with a generation.
+        uint32_t generation = config->generation + 1;
+        size_t written = 0;
+        for (size_t i = 0; i < txn->count && success; i++)
+        {
+            success = change_write(config, change_line(config, &txn->changes[i]), &txn->changes[i], generation);
+            written += success;
+        }
+        if (written > 0) generation_bump(config);
+        sequence_write_end(config);
+        if (!success)
+            ERROR_REPORT("failed to commit the transaction, %zi of %zi changes written", written, txn->count);
+
+        if (written > 0) subscriptions_notify(config, 0);
+    }
+
+    tc_txn_abort(txn);
+    return success;
+}
+
+/// Return a read only config with the current lines of the config, which later loads and sets
+/// don't change, see "Snapshots". It's released with tc_snapshot_release from any thread. Only
+/// TC_GROW configs with a source of their own (not in a borrowed scratch buffer) can be
+/// snapshotted, NULL is returned for the others and when memory runs out. The first snapshot of
+/// a TC_LAZY load materializes the lines still in the source, which costs O(n).
+extern tc_config *tc_snapshot(tc_config *config)
+{
+    assert(!(config->flags & TC_SNAPSHOT));
+    if (!(config->flags & TC_GROW) || (config->scratch.borrowed && config->source == config->scratch.data))
+    {
+        ERROR_REPORT("snapshots need a TC_GROW config with a source of its own (flags %u)", config->flags);
+        return NULL;
+    }
+
+    const tc_allocator *allocator = config_allocator(config);
+    config_snapshot *snapshot = memory_alloc(allocator, sizeof(config_snapshot));
+    if (snapshot == NULL) return NULL;
+    if (config->shared == NULL)
     {
-        size_t offset = line_offset_get(config, i);
-        char *key_start = header_read(line_get(config, i));
-        if (key_compare(key, offset - 1, key_start))
+        tc_shared *shared = memory_alloc(allocator, sizeof(tc_shared));
+        if (shared == NULL)
+        {
+            memory_free(allocator, snapshot, sizeof(config_snapshot));
+            return NULL;
+        }
+        *shared = (tc_shared) {
+            .references      = 1,
+            .index           = config->index,
+            .index_size      = config->index_size,
+            .source          = config->source,
+            .source_capacity = config->source_capacity,
+            .allocator       = allocator,
+        };
+        config->shared = shared;
+
+        // Lines are only left in the source by a load, so no other snapshot shares them yet.
+        if ((config->flags & TC_LAZY) && !(config->flags & TC_VIEW))
         {
-            char *value_start = &key_start[offset];
-            string_copy_slice_null(
-                new_value,
-                0,
-                new_value_length - 1,
-                value_start
-            );
-            return value_start;
+            sequence_write_begin(config);
+            size_t value_length;
+            for (size_t i = 0; i < config->size; i++)
+                if (line_in_source(config, i)) line_value(config, i, &value_length);
+            sequence_write_end(config);
         }
     }
 
-    return NULL;
+    *snapshot = (config_snapshot) {
+        .config = {
+            .size            = config->size,
+            .index           = config->index,
+            .index_size      = config->index_size,
+            .flags           = (config->flags & (TC_LAZY | TC_VIEW | TC_GROW | TC_READ_CACHE)) | TC_SNAPSHOT,
+            .source          = config->source,
+            .source_capacity = config->source_capacity,
+            .allocator       = config->allocator,
+            .chunks          = config->chunks,
+            .chunk_count     = config->chunk_count,
+            .generation      = config->generation,
+            .shared          = config->shared,
+        },
+        .references = 1,
+    };
+    if (config->chunks != NULL) counted_retain(config->chunks);
+    atomic_increment(&config->shared->references);
+    return &snapshot->config;
+}
+
+/// Take another reference to the snapshot, for another thread or job.
+extern tc_config *tc_snapshot_retain(tc_config *snapshot)
+{
+    assert(snapshot->flags & TC_SNAPSHOT);
+    atomic_increment(&((config_snapshot *) snapshot)->references);
+    return snapshot;
+}
+
+/// Drop a reference to the snapshot, the last one releases it alongside the storage that only it
+/// still shares.
+extern void tc_snapshot_release(tc_config *snapshot)
+{
+    if (snapshot == NULL) return;
+    assert(snapshot->flags & TC_SNAPSHOT);
+    if (atomic_decrement(&((config_snapshot *) snapshot)->references) != 0) return;
+
+    const tc_allocator *allocator = config_allocator(snapshot);
+    chunk_table_release(allocator, snapshot->chunks, snapshot->chunk_count);
+    shared_release(snapshot->shared);
+    memory_free(allocator, snapshot, sizeof(config_snapshot));
+    read_cache_reset();
+}
+
+/// Release the memory owned by the config (the scratch buffer, the source kept by TC_LAZY and
+/// TC_VIEW, the storage of TC_OWNED configs, the TC_PROFILE access counts and the
+/// TC_LINE_GENERATIONS generations) and drop its subscriptions, the config is left empty and can
+/// be loaded again. The
+/// generation is kept, so that it keeps increasing when the config is loaded again.
+extern void tc_free_config(tc_config *config)
+{
+    assert(!(config->flags & TC_SNAPSHOT));
+    const tc_allocator *allocator = config_allocator(config);
+    config_owned_free(config);
+    config_source_free(config);
+    if (!config->scratch.borrowed)
+        memory_free(allocator, config->scratch.data, config->scratch.capacity);
+    config->scratch = (tc_scratch) {0};
+    config->size    = 0;
+
+    memory_free(allocator, config->access_counts, config->access_capacity * sizeof(uint32_t));
+    config->access_counts   = NULL;
+    config->access_capacity = 0;
+    memory_free(
+        allocator, config->line_generations, config->line_generations_capacity * sizeof(uint32_t)
+    );
+    config->line_generations          = NULL;
+    config->line_generations_capacity = 0;
+    subscriptions_free(config);
+    pending_free(config);
+    // tc_get_value_copy on another thread can still hold the record.
+    storage_retire(storage_swap(config, NULL));
+    read_cache_reset();
+}
+
+/// Read the files of the following loads into the caller owned scratch buffer of capacity bytes,
+/// which is never reallocated nor freed by the library. Files that don't fit fail to load, and
+/// the source of TC_LAZY and TC_VIEW configs lives in the buffer until the next load. A NULL
+/// scratch goes back to a buffer allocated by the library.
+extern void tc_set_scratch(tc_config *config, void *scratch, size_t capacity)
+{
+    // A source inside of the previous borrowed buffer can't be kept.
+    if (config->scratch.borrowed && config->source == config->scratch.data)
+    {
+        config->source = NULL;
+        config->size   = 0;
+        storage_reset(config);
+        read_cache_reset();
+    }
+    if (!config->scratch.borrowed)
+        memory_free(config_allocator(config), config->scratch.data, config->scratch.capacity);
+    config->scratch = (tc_scratch) {
+        .data     = scratch,
+        .capacity = scratch != NULL ? capacity : 0,
+        .borrowed = scratch != NULL,
+    };
+}
+
+/// Call callback with the new value of key (ptr is NULL when the key was removed) after every
+/// load or tc_set_value that changes it, on the thread that loads or sets. A key subscribed many
+/// times gets one call per subscription.
+extern bool tc_subscribe(tc_config *config, const char *key, tc_callback callback, void *ctx)
+{
+    assert(key != NULL && callback != NULL);
+    const tc_allocator *allocator = config_allocator(config);
+
+    if (config->subscription_count == config->subscription_capacity)
+    {
+        size_t capacity = config->subscription_capacity > 0 ? config->subscription_capacity * 2 : 4;
+        tc_subscription *subscriptions = memory_grow(
+            allocator,
+            config->subscriptions,
+            config->subscription_capacity * sizeof(tc_subscription),
+            capacity * sizeof(tc_subscription)
+        );
+        if (subscriptions == NULL) return false;
+        config->subscriptions         = subscriptions;
+        config->subscription_capacity = capacity;
+    }
+
+    tc_subscription subscription = { .callback = callback, .ctx = ctx };
+    subscription.key_hash = key_hash_null(key, &subscription.key_length);
+    subscription.key      = memory_alloc(allocator, subscription.key_length + 1);
+    if (subscription.key == NULL) return false;
+    memcpy(subscription.key, key, subscription.key_length + 1);
+
+    // Only the changes after subscribing are notified.
+    subscription_update(config, &subscription);
+    config->subscriptions[config->subscription_count++] = subscription;
+    return true;
+}
+
+/// Remove the subscriptions of key with the same callback and ctx. Inside of a callback, they're
+/// no longer called and are freed once the notification ends.
+extern void tc_unsubscribe(tc_config *config, const char *key, tc_callback callback, void *ctx)
+{
+    for (size_t i = 0; i < config->subscription_count; i++)
+    {
+        tc_subscription *subscription = &config->subscriptions[i];
+        if (subscription->callback == callback && subscription->ctx == ctx
+            && strcmp(subscription->key, key) == 0)
+            subscription->removed = true;
+    }
+    if (config->subscription_depth == 0) subscriptions_compact(config);
+}
+
+/// Move the most read lines of a TC_PROFILE config to its first slots, lines that were read as
+/// many times keep their order. Values returned before point to other keys afterwards, so it
+/// must not run while other threads read the config.
+extern bool tc_optimize_layout(tc_config *config)
+{
+    if (config->access_counts == NULL || config->size < 2) return true;
+
+    layout_entry *entries = layout_by_access(config);
+    bool success = entries != NULL && layout_apply(config, entries);
+    if (!success) ERROR_REPORT("failed to allocate the layout of %zi lines", config->size);
+    success = storage_reset(config) && success;
+    read_cache_reset();
+
+    memory_free(global_allocator, entries, config->size * sizeof(layout_entry));
+    return success;
+}
+
+/// Write the key hashes of the config to hashes, from the most to the least read key (in line
+/// order without TC_PROFILE), and return how many were written, at most capacity. Set them on
+/// tc_config.profile so that the following loads start with the same layout.
+extern size_t tc_export_profile(tc_config *config, uint32_t *hashes, size_t capacity)
+{
+    if (config->size == 0) return 0;
+
+    layout_entry *entries = layout_by_access(config);
+    if (entries == NULL) return 0;
+
+    size_t count = 0;
+    for (size_t i = 0; i < config->size && count < capacity; i++)
+    {
+        uint32_t hash;
+        if (line_indexed_hash(config, entries[i].line, &hash)) hashes[count++] = hash;
+    }
+
+    memory_free(global_allocator, entries, config->size * sizeof(layout_entry));
+    return count;
+}
+
+/// Allocate the memory of configs without an allocator, and the temporary memory of the library,
+/// with allocator. A NULL allocator goes back to malloc and free. Memory is freed by the allocator
+/// that allocated it, so change it only while no config holds memory.
+extern void tc_set_allocator(const tc_allocator *allocator)
+{
+    global_allocator = allocator != NULL ? allocator : &heap_allocator;
 }
 
 extern bool tc_save_to_file(tc_config *config, const char *file_path)
@@ -465,6 +4987,15 @@ extern bool tc_save_to_file(tc_config *config, const char *file_path)
 
     for (size_t i = 0; i < config->size; i++)
     {
+        if (line_in_source(config, i))
+        {
+            size_t key_length, value_length;
+            const char *key_start = line_key(config, i, &key_length);
+            const char *value     = line_value(config, i, &value_length);
+            fprintf(file, "%.*s=%.*s\n", (int) key_length, key_start, (int) value_length, value);
+            continue;
+        }
+
         char *key_start = header_read(line_get(config, i));
         fprintf(file, "%s\n", key_start);
     }
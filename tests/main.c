@@ -1,5 +1,11 @@
-#include <string.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#endif
 
 #include "tinyconfig.h"
 
@@ -12,6 +18,203 @@
 
 #define STRING_COMPARE(x, y) strcmp(x, y) == 0
 
+// Value offset stored in the header of the first line of a config.
+#ifdef TC_COMPACT_HEADER
+#define FIRST_LINE_OFFSET(config) (((tc_line_header *) (config).buffer)->offset)
+#else
+#define FIRST_LINE_OFFSET(config) (*((size_t *) (config).buffer) & TC_HEADER_OFFSET_MASK)
+#endif
+
+// Generated at build time from test.conf by tinyconfig_embed.
+extern tc_config test_conf;
+
+// Allocator that counts the bytes in use and checks the sizes given to free.
+typedef struct {
+    atomic_long bytes;
+    atomic_long allocations;
+    atomic_long wrong_sizes;
+    // Allocations fail while it's set.
+    atomic_bool refuse;
+} counting_context;
+
+void *counting_alloc(void *ctx, size_t size) {
+    counting_context *counting = ctx;
+    if (counting->refuse) return NULL;
+    size_t *ptr = malloc(sizeof(size_t) * 2 + size);
+    ptr[0] = size;
+    counting->bytes += (long) size;
+    counting->allocations += 1;
+    return ptr + 2;
+}
+
+void counting_free(void *ctx, void *ptr, size_t size) {
+    counting_context *counting = ctx;
+    size_t *start = (size_t *) ptr - 2;
+    if (start[0] != size) counting->wrong_sizes += 1;
+    counting->bytes -= (long) start[0];
+    free(start);
+}
+
+#ifndef __STDC_NO_THREADS__
+// Sets programsafety to runs of a single letter while the main thread copies it out.
+int set_value_writer(void *arg) {
+    tc_config *config = arg;
+    char value[] = "aaaaaaaaaaaa";
+    for (int i = 0; i < 20000; i++)
+    {
+        memset(value, 'a' + i % 26, sizeof(value) - 1 - i % 5);
+        value[sizeof(value) - 1 - i % 5] = '\0';
+        tc_set_value(config, "programsafety", value);
+    }
+    return 0;
+}
+
+// Commits window sizes of matching width and height while the main thread reads both.
+int txn_writer(void *arg) {
+    tc_config *config = arg;
+    for (int i = 0; i < 5000; i++)
+    {
+        tc_txn txn;
+        tc_txn_begin(config, &txn);
+        tc_txn_set(&txn, "window_width", i % 2 ? "1920" : "1280");
+        tc_txn_set(&txn, "window_height", i % 2 ? "1080" : "720");
+        tc_txn_commit(&txn);
+    }
+    return 0;
+}
+
+// Copies the keys of test_swap_big.conf while the main thread swaps it with test_swap_small.conf.
+typedef struct {
+    tc_config  *config;
+    atomic_bool done;
+    atomic_int  wrong;
+} swap_reader_context;
+
+int swap_reader(void *arg) {
+    swap_reader_context *context = arg;
+    for (int i = 0; !atomic_load(&context->done); i++)
+    {
+        char key[16], value[16];
+        snprintf(key, sizeof(key), "key_%c%c", 'a' + i % 200 / 26, 'a' + i % 200 % 26);
+        tc_str copy = tc_get_value_copy(context->config, key, value, sizeof(value));
+        bool correct = copy.ptr == NULL ? i % 200 != 0
+            : STRING_COMPARE(value, "big") || (i % 200 == 0 && STRING_COMPARE(value, "small"));
+        if (!correct) atomic_fetch_add(&context->wrong, 1);
+    }
+    return 0;
+}
+
+// Reads window_width between tc_read_enter and tc_read_leave while the main thread reloads.
+typedef struct {
+    tc_config *config;
+    bool       torn;
+} epoch_reader_context;
+
+int epoch_reader(void *arg) {
+    epoch_reader_context *context = arg;
+    for (int i = 0; i < 20000 && !context->torn; i++)
+    {
+        tc_read_enter();
+        const char *width = tc_get_value(context->config, "window_width");
+        char first[8];
+        snprintf(first, sizeof(first), "%s", width);
+        if (strcmp(first, "1280") != 0 && strcmp(first, "1920") != 0) context->torn = true;
+        for (int spin = 0; spin < 100; spin++)
+            if (strcmp(width, first) != 0) context->torn = true;
+        tc_read_leave();
+    }
+    return 0;
+}
+
+// Reads the values of test.conf through the read cache of another thread.
+int cache_reader(void *arg) {
+    tc_config *config = arg;
+    bool correct = true;
+    for (int i = 0; i < 1000; i++)
+        correct = correct && STRING_COMPARE(tc_get_value(config, "ip_address"), "172.165.10.02")
+            && tc_get_value_sv(config, "random_text").len == 28;
+    return correct;
+}
+
+// Queues 500 sets of workers, retrying while the queue is full.
+int pending_producer(void *arg) {
+    tc_config *config = arg;
+    for (int i = 0; i < 500; i++)
+    {
+        char value[16];
+        snprintf(value, sizeof(value), "%d", i + 1);
+        while (!tc_queue_set_value(config, "workers", value)) thrd_yield();
+    }
+    return 0;
+}
+#endif
+
+// Counts the calls of each subscribed key and keeps the last value.
+typedef struct {
+    int  calls;
+    char value[32];
+} subscription_record;
+
+void subscription_callback(tc_config *config, const char *key, tc_str value, void *ctx) {
+    (void) config;
+    (void) key;
+    subscription_record *record = ctx;
+    record->calls += 1;
+    snprintf(record->value, sizeof(record->value), "%s", value.ptr != NULL ? value.ptr : "(removed)");
+}
+
+// Unsubscribes itself, then keeps reading its key.
+void unsubscribing_callback(tc_config *config, const char *key, tc_str value, void *ctx) {
+    (void) value;
+    subscription_record *record = ctx;
+    tc_unsubscribe(config, key, unsubscribing_callback, ctx);
+    record->calls += 1;
+    snprintf(record->value, sizeof(record->value), "%s", key);
+}
+
+// Sets added from the callback of another key.
+void writing_callback(tc_config *config, const char *key, tc_str value, void *ctx) {
+    subscription_callback(config, key, value, ctx);
+    tc_set_value(config, "added", "nested");
+}
+
+#ifndef __STDC_NO_THREADS__
+// Counts the callbacks that ran while another callback of the config was running.
+atomic_int exclusive_inside = 0;
+atomic_int exclusive_overlaps = 0;
+
+void exclusive_callback(tc_config *config, const char *key, tc_str value, void *ctx) {
+    (void) config;
+    (void) key;
+    (void) value;
+    (void) ctx;
+    if (++exclusive_inside != 1) exclusive_overlaps += 1;
+    thrd_yield();
+    exclusive_inside -= 1;
+}
+
+// Sets log_level to values of its own, while another writer does the same.
+int exclusive_writer(void *arg) {
+    tc_config *config = arg;
+    char value[16];
+    for (int i = 0; i < 500; i++)
+    {
+        snprintf(value, sizeof(value), "%d", i);
+        tc_set_value(config, "log_level", value);
+    }
+    return 0;
+}
+#endif
+
+// Accepts configs whose window_width is a positive number.
+bool width_validator(tc_config *staged, void *ctx, tc_error *error) {
+    (void) ctx;
+    const char *width = tc_get_value(staged, "window_width");
+    if (width != NULL && atoi(width) > 0) return true;
+    snprintf(error->message, sizeof(error->message), "window_width must be positive");
+    return false;
+}
+
 void test_config_values(tc_config *config) {
     const char *ip_address = tc_get_value(config, "ip_address");
     TEST("Dot separated numbers", STRING_COMPARE(ip_address, "172.165.10.02"));
@@ -56,6 +259,15 @@ int main(void) {
     printf("\nINIT tc_get_value tests\n");
     test_config_values(&config);
 
+    // Without an index the lines are scanned, compact headers skip them by their hash byte.
+    tc_config scan_config = config;
+    scan_config.index = NULL;
+    test_config_values(&scan_config);
+#ifdef TC_COMPACT_HEADER
+    TEST("compact header is smaller than size_t", TC_HEADER_SIZE < sizeof(size_t));
+    TEST("compact slots are aligned", TC_LINE_TOTAL_SIZE % 4 == 0);
+#endif
+
     // --------------------
     // tc_save_to_file 
     // --------------------
@@ -66,6 +278,14 @@ int main(void) {
     tc_load_config(&config, "test2.conf");
     test_config_values(&config);
 
+    // The read buffer of the previous load is reused and must grow with the file.
+    FILE *grown_file = fopen("test2.conf", "a");
+    fprintf(grown_file, "# %0200d\n", 0);
+    fclose(grown_file);
+    ret = tc_load_config(&config, "test2.conf");
+    TEST("reload of a grown file", ret == true && config.size == 8);
+    test_config_values(&config);
+
     // --------------------
     // tc_set_value 
     // --------------------
@@ -75,6 +295,875 @@ int main(void) {
     tc_set_value(&config, "programsafety", "very_safe");
     const char *new_safety = tc_get_value(&config, "programsafety");
     TEST("raw string very_safe", STRING_COMPARE(new_safety, "very_safe"));
+    tc_free_config(&config);
+
+    // --------------------
+    // TC_LAZY
+    // --------------------
+    printf("\nINIT TC_LAZY tests\n");
+    tc_config lazy_config = { .flags = TC_LAZY };
+    ret = tc_load_config(&lazy_config, "test.conf");
+    TEST("lazy tc_load_config success return", ret == true);
+    TEST("lazy config->size = 8", lazy_config.size == 8);
+    TEST("lazy source is kept", lazy_config.source != NULL);
+    TEST("lazy line isn't materialized", FIRST_LINE_OFFSET(lazy_config) == 0);
+    test_config_values(&lazy_config);
+    TEST("lazy line is materialized on access", FIRST_LINE_OFFSET(lazy_config) == 11);
+
+    // --------------------
+    // tc_get_value_sv and TC_VIEW
+    // --------------------
+    printf("\nINIT tc_get_value_sv tests\n");
+    tc_str random_text = tc_get_value_sv(&lazy_config, "random_text");
+    TEST("tc_get_value_sv length", random_text.len == strlen("Some whitespaced random text"));
+    TEST("tc_get_value_sv missing key", tc_get_value_sv(&lazy_config, "ip").ptr == NULL);
+
+    tc_config view_config = { .flags = TC_VIEW };
+    ret = tc_load_config(&view_config, "test.conf");
+    TEST("view tc_load_config success return", ret == true);
+    test_config_values(&view_config);
+    tc_str dotted_text = tc_get_value_sv(&view_config, "dotted_text");
+    TEST("view value points into the source",
+        dotted_text.ptr > view_config.source && dotted_text.len == strlen("com.domain.example"));
+    tc_set_value(&view_config, "dotted_text", "com.example");
+    TEST("view tc_set_value", STRING_COMPARE(tc_get_value(&view_config, "dotted_text"), "com.example"));
+    TEST("view tc_set_value length", tc_get_value_sv(&view_config, "dotted_text").len == 11);
+
+    // Reloads go back and forth between the source and the scratch buffer.
+    char *first_source = view_config.source;
+    tc_load_config(&view_config, "test.conf");
+    char *second_source = view_config.source;
+    tc_load_config(&view_config, "test.conf");
+    TEST("view reload swaps the scratch buffer", second_source != first_source && view_config.source == first_source);
+    test_config_values(&view_config);
+
+    // --------------------
+    // tc_get_value_copy
+    // --------------------
+    printf("\nINIT tc_get_value_copy tests\n");
+    tc_config copy_config = { .flags = TC_LAZY };
+    tc_load_config(&copy_config, "test.conf");
+    char copy_buffer[32];
+    tc_str copied = tc_get_value_copy(&copy_config, "random_text", copy_buffer, sizeof(copy_buffer));
+    TEST("tc_get_value_copy value", copied.ptr == copy_buffer && STRING_COMPARE(copy_buffer, "Some whitespaced random text"));
+    TEST("tc_get_value_copy doesn't materialize lazy lines", FIRST_LINE_OFFSET(copy_config) == 0);
+    TEST("tc_get_value_copy missing key", tc_get_value_copy(&copy_config, "ip", copy_buffer, 32).ptr == NULL);
+    TEST("tc_get_value_copy small buffer", tc_get_value_copy(&copy_config, "random_text", copy_buffer, 28).ptr == NULL);
+    TEST("tc_set_value bumps the sequence", tc_set_value(&copy_config, "ip_address", "10.0.0.1") != NULL && copy_config.sequence == 2);
+    copied = tc_get_value_copy(&copy_config, "ip_address", copy_buffer, sizeof(copy_buffer));
+    TEST("tc_get_value_copy after tc_set_value", copied.len == 8 && STRING_COMPARE(copy_buffer, "10.0.0.1"));
+
+#ifndef __STDC_NO_THREADS__
+    tc_set_value(&copy_config, "programsafety", "zzzz");
+    thrd_t writer;
+    thrd_create(&writer, set_value_writer, &copy_config);
+    bool torn = false;
+    for (int i = 0; i < 20000 && !torn; i++)
+    {
+        copied = tc_get_value_copy(&copy_config, "programsafety", copy_buffer, sizeof(copy_buffer));
+        torn = copied.ptr == NULL || copied.len != strlen(copy_buffer);
+        for (size_t c = 1; c < copied.len && !torn; c++) torn = copy_buffer[c] != copy_buffer[0];
+    }
+    thrd_join(writer, NULL);
+    TEST("tc_get_value_copy never sees a torn value", !torn && copy_config.sequence == 4 + 2 * 20000);
+#endif
+    tc_free_config(&copy_config);
+
+    tc_free_config(&lazy_config);
+    tc_free_config(&view_config);
+    TEST("tc_free_config releases the source", view_config.source == NULL && view_config.size == 0);
+
+    // --------------------
+    // tc_set_scratch
+    // --------------------
+    printf("\nINIT tc_set_scratch tests\n");
+    static char scratch[512];
+    tc_config scratch_config = { .flags = TC_VIEW };
+    tc_set_scratch(&scratch_config, scratch, sizeof(scratch));
+    ret = tc_load_config(&scratch_config, "test.conf");
+    TEST("scratch tc_load_config success return", ret == true && scratch_config.source == scratch);
+    test_config_values(&scratch_config);
+    tc_set_scratch(&scratch_config, scratch, 64);
+    ret = tc_load_config(&scratch_config, "test.conf");
+    TEST("scratch too small fails", ret == false && scratch_config.size == 0);
+    tc_free_config(&scratch_config);
+
+    // --------------------
+    // TC_PARALLEL
+    // --------------------
+    printf("\nINIT TC_PARALLEL tests\n");
+    tc_config parallel_config = { .flags = TC_PARALLEL };
+    ret = tc_load_config(&parallel_config, "test.conf");
+    TEST("parallel tc_load_config success return", ret == true);
+    TEST("parallel config->size = 8", parallel_config.size == 8);
+    test_config_values(&parallel_config);
+    tc_free_config(&parallel_config);
+
+    tc_config parallel_view_config = { .flags = TC_PARALLEL | TC_VIEW };
+    ret = tc_load_config(&parallel_view_config, "test.conf");
+    TEST("parallel view tc_load_config success return", ret == true);
+    test_config_values(&parallel_view_config);
+    tc_free_config(&parallel_view_config);
+
+    // --------------------
+    // TC_GROW
+    // --------------------
+    printf("\nINIT TC_GROW tests\n");
+    FILE *grow_file = fopen("test_grow.conf", "w");
+    for (int i = 0; i < 100; i++)
+        fprintf(grow_file, "key_%c%c = value_%d\n", 'a' + i / 26, 'a' + i % 26, i);
+    fclose(grow_file);
+
+    tc_config small_config = {0};
+    ret = tc_load_config(&small_config, "test_grow.conf");
+    TEST("more than TC_CONFIG_MAX_SIZE lines fail", ret == false);
+    tc_free_config(&small_config);
+
+    tc_config grow_config = { .flags = TC_GROW };
+    ret = tc_load_config(&grow_config, "test_grow.conf");
+    TEST("grow tc_load_config success return", ret == true && grow_config.size == 100);
+    TEST("grow first chunk value", STRING_COMPARE(tc_get_value(&grow_config, "key_aa"), "value_0"));
+    TEST("grow last chunk value", STRING_COMPARE(tc_get_value(&grow_config, "key_dv"), "value_99"));
+    TEST("grow index is bigger than the lines", grow_config.index_size > 100);
+    ret = tc_load_config(&grow_config, "test.conf");
+    TEST("grow reload keeps the chunks", ret == true && grow_config.size == 8 && grow_config.chunk_count == 2);
+    test_config_values(&grow_config);
+    tc_free_config(&grow_config);
+    TEST("tc_free_config releases the chunks", grow_config.chunks == NULL && grow_config.index == NULL);
+
+    tc_config grow_parallel_config = { .flags = TC_GROW | TC_PARALLEL | TC_VIEW };
+    ret = tc_load_config(&grow_parallel_config, "test_grow.conf");
+    TEST("grow parallel view tc_load_config", ret == true && grow_parallel_config.size == 100);
+    TEST("grow parallel view value", STRING_COMPARE(tc_get_value(&grow_parallel_config, "key_cs"), "value_70"));
+    tc_free_config(&grow_parallel_config);
+
+    // The key without a value after a full chunk of lines is stored in a line reserved before
+    // the threads start.
+    grow_file = fopen("test_grow.conf", "w");
+    for (int i = 0; i < TC_GROW_CHUNK_LINES; i++)
+        fprintf(grow_file, "key_%c%c = value_%d\n", 'a' + i / 26, 'a' + i % 26, i);
+    fprintf(grow_file, "bare\n");
+    fclose(grow_file);
+    grow_parallel_config = (tc_config) { .flags = TC_GROW | TC_PARALLEL };
+    ret = tc_load_config(&grow_parallel_config, "test_grow.conf");
+    TEST("grow parallel bare last key", ret == true && grow_parallel_config.size == TC_GROW_CHUNK_LINES
+        && STRING_COMPARE(tc_get_value(&grow_parallel_config, "key_aa"), "value_0"));
+    tc_free_config(&grow_parallel_config);
+    remove("test_grow.conf");
+
+    // --------------------
+    // Generations
+    // --------------------
+    printf("\nINIT generation tests\n");
+    tc_config generation_config = { .flags = TC_LINE_GENERATIONS };
+    TEST("generation is 0 before loading", tc_generation(&generation_config) == 0);
+    tc_load_config(&generation_config, "test.conf");
+    uint32_t loaded_generation = tc_generation(&generation_config);
+    TEST("load bumps the generation", loaded_generation == 1);
+    TEST("lines get the load generation", tc_key_generation(&generation_config, "programsafety") == 1);
+    tc_set_value(&generation_config, "programsafety", "safe");
+    TEST("tc_set_value bumps the generation", tc_generation(&generation_config) == 2);
+    TEST("tc_set_value bumps its line", tc_key_generation(&generation_config, "programsafety") == 2);
+    TEST("other lines keep their generation", tc_key_generation(&generation_config, "ip_address") == 1);
+    TEST("missing key has no generation", tc_key_generation(&generation_config, "ip") == 0);
+    tc_load_config(&generation_config, "test.conf");
+    TEST("reload bumps every line", tc_generation(&generation_config) == 3
+        && tc_key_generation(&generation_config, "ip_address") == 3);
+    tc_free_config(&generation_config);
+    TEST("tc_free_config keeps the generation", tc_generation(&generation_config) == 3
+        && generation_config.line_generations == NULL);
+
+    tc_config plain_generation_config = {0};
+    tc_load_config(&plain_generation_config, "test.conf");
+    tc_set_value(&plain_generation_config, "programsafety", "safe");
+    TEST("tc_key_generation without TC_LINE_GENERATIONS",
+        tc_key_generation(&plain_generation_config, "ip_address") == 2);
+    tc_free_config(&plain_generation_config);
+
+    // --------------------
+    // tc_reload_if_changed
+    // --------------------
+    printf("\nINIT tc_reload_if_changed tests\n");
+    FILE *reload_file = fopen("test_reload.conf", "w");
+    fprintf(reload_file, "log_level = info\n");
+    fclose(reload_file);
+
+    tc_config reload_config = {0};
+    ret = tc_reload_if_changed(&reload_config, "test_reload.conf");
+    TEST("first tc_reload_if_changed loads", ret == true && tc_generation(&reload_config) == 1);
+    ret = tc_reload_if_changed(&reload_config, "test_reload.conf");
+    TEST("unchanged file isn't loaded", ret == true && tc_generation(&reload_config) == 1);
+
+    // Same content written again, the stat changes but the content hash doesn't.
+    reload_file = fopen("test_reload.conf", "w");
+    fprintf(reload_file, "log_level = info\n");
+    fclose(reload_file);
+    reload_config.fingerprint.modified_nanoseconds += 1;
+    ret = tc_reload_if_changed(&reload_config, "test_reload.conf");
+    TEST("same content isn't loaded", ret == true && tc_generation(&reload_config) == 1);
+
+    reload_file = fopen("test_reload.conf", "w");
+    fprintf(reload_file, "log_level = debug\n");
+    fclose(reload_file);
+    reload_config.fingerprint.modified_nanoseconds += 1;
+    ret = tc_reload_if_changed(&reload_config, "test_reload.conf");
+    TEST("changed content is loaded", ret == true && tc_generation(&reload_config) == 2
+        && STRING_COMPARE(tc_get_value(&reload_config, "log_level"), "debug"));
+
+    tc_load_config(&reload_config, "test_reload.conf");
+    TEST("tc_load_config doesn't hash the file", reload_config.fingerprint.has_hash == false
+        && reload_config.fingerprint.has_stat == false);
+    ret = tc_reload_if_changed(&reload_config, "test_reload.conf");
+    TEST("reload after tc_load_config parses again", ret == true && tc_generation(&reload_config) == 4
+        && reload_config.fingerprint.has_hash == true);
+    ret = tc_reload_if_changed(&reload_config, "test_reload.conf");
+    TEST("then the file is skipped", ret == true && tc_generation(&reload_config) == 4);
+    TEST("missing file fails", tc_reload_if_changed(&reload_config, "missing.conf") == false);
+    tc_free_config(&reload_config);
+    remove("test_reload.conf");
+
+    // --------------------
+    // tc_reload_staged
+    // --------------------
+    printf("\nINIT tc_reload_staged tests\n");
+    // The last two borrow a scratch buffer, which holds the live source of the TC_VIEW config.
+    const unsigned int staged_flags[] = { 0, TC_LAZY, TC_VIEW, TC_GROW, 0, TC_VIEW };
+    char staged_scratch[256];
+    bool staged_commits = true, staged_parse_rollbacks = true, staged_validation_rollbacks = true;
+    for (size_t i = 0; i < sizeof(staged_flags) / sizeof(staged_flags[0]); i++)
+    {
+        FILE *staged_file = fopen("test_staged.conf", "w");
+        fprintf(staged_file, "window_width = 1280\nwindow_height = 720\n");
+        fclose(staged_file);
+
+        tc_config staged_config = { .flags = staged_flags[i] };
+        if (i >= 4) tc_set_scratch(&staged_config, staged_scratch, sizeof(staged_scratch));
+        tc_error error;
+        ret = tc_reload_staged(&staged_config, "test_staged.conf", width_validator, NULL, &error);
+        staged_commits = staged_commits && ret && error.kind == TC_ERROR_NONE
+            && tc_generation(&staged_config) == 1
+            && STRING_COMPARE(tc_get_value(&staged_config, "window_height"), "720");
+
+        // The bad key comes after a line that was already parsed.
+        staged_file = fopen("test_staged.conf", "w");
+        fprintf(staged_file, "window_width = 1920\nwindow-height = 1080\n");
+        fclose(staged_file);
+        ret = tc_reload_staged(&staged_config, "test_staged.conf", width_validator, NULL, &error);
+        staged_parse_rollbacks = staged_parse_rollbacks && !ret && error.kind == TC_ERROR_PARSE
+            && strstr(error.message, "illegal character") != NULL && tc_generation(&staged_config) == 1
+            && STRING_COMPARE(tc_get_value(&staged_config, "window_width"), "1280");
+
+        staged_file = fopen("test_staged.conf", "w");
+        fprintf(staged_file, "window_width = -1\nwindow_height = 1080\n");
+        fclose(staged_file);
+        ret = tc_reload_staged(&staged_config, "test_staged.conf", width_validator, NULL, &error);
+        staged_validation_rollbacks = staged_validation_rollbacks && !ret
+            && error.kind == TC_ERROR_VALIDATION
+            && STRING_COMPARE(error.message, "window_width must be positive")
+            && STRING_COMPARE(tc_get_value(&staged_config, "window_height"), "720");
+
+        staged_file = fopen("test_staged.conf", "w");
+        fprintf(staged_file, "window_width = 1920\nwindow_height = 1080\n");
+        fclose(staged_file);
+        ret = tc_reload_staged(&staged_config, "test_staged.conf", width_validator, NULL, &error);
+        staged_commits = staged_commits && ret && tc_generation(&staged_config) == 2
+            && STRING_COMPARE(tc_get_value(&staged_config, "window_height"), "1080");
+        tc_free_config(&staged_config);
+    }
+    TEST("tc_reload_staged commits valid files", staged_commits);
+    TEST("parse errors keep the previous config", staged_parse_rollbacks);
+    TEST("rejected configs keep the previous config", staged_validation_rollbacks);
+
+    tc_config missing_config = {0};
+    tc_error missing_error;
+    ret = tc_reload_staged(&missing_config, "missing.conf", NULL, NULL, &missing_error);
+    TEST("missing file is a read error", !ret && missing_error.kind == TC_ERROR_READ
+        && strstr(missing_error.message, "missing.conf") != NULL);
+
+    // A null byte inside of a value is an error of the value, not of the next key.
+    FILE *null_file = fopen("test_staged.conf", "wb");
+    fwrite("window_width = 1920\nwindow_title = ab\0cd\n", 1, 41, null_file);
+    fclose(null_file);
+    tc_config null_config = {0};
+    tc_error null_error;
+    ret = tc_reload_staged(&null_config, "test_staged.conf", NULL, NULL, &null_error);
+    TEST("null byte in a value is a value error", !ret && null_error.kind == TC_ERROR_PARSE
+        && strstr(null_error.message, "value at line 1") != NULL);
+    tc_free_config(&null_config);
+    remove("test_staged.conf");
+
+#ifndef __STDC_NO_THREADS__
+    // Readers never pair the index of one file with the storage of the other.
+    const unsigned int swap_flags[] = { 0, TC_VIEW, TC_GROW, TC_GROW | TC_LAZY };
+    bool swap_correct = true;
+    for (size_t i = 0; i < sizeof(swap_flags) / sizeof(swap_flags[0]); i++)
+    {
+        FILE *swap_file = fopen("test_swap_small.conf", "w");
+        fprintf(swap_file, "key_aa = small\n");
+        fclose(swap_file);
+        swap_file = fopen("test_swap_big.conf", "w");
+        int swap_lines = swap_flags[i] & TC_GROW ? 200 : TC_CONFIG_MAX_SIZE;
+        for (int line = 0; line < swap_lines; line++)
+            fprintf(swap_file, "key_%c%c = big\n", 'a' + line / 26, 'a' + line % 26);
+        fclose(swap_file);
+
+        tc_config swap_config = { .flags = swap_flags[i] };
+        tc_reload_staged(&swap_config, "test_swap_small.conf", NULL, NULL, NULL);
+        swap_reader_context swap_context = { .config = &swap_config };
+        thrd_t swap_threads[3];
+        for (int t = 0; t < 3; t++) thrd_create(&swap_threads[t], swap_reader, &swap_context);
+        for (int reload = 0; reload < 1000; reload++)
+        {
+            const char *path = reload % 2 ? "test_swap_small.conf" : "test_swap_big.conf";
+            swap_correct = tc_reload_staged(&swap_config, path, NULL, NULL, NULL) && swap_correct;
+        }
+        atomic_store(&swap_context.done, true);
+        for (int t = 0; t < 3; t++) thrd_join(swap_threads[t], NULL);
+        swap_correct = swap_correct && atomic_load(&swap_context.wrong) == 0;
+        tc_free_config(&swap_config);
+    }
+    TEST("tc_get_value_copy across reloads of different sizes", swap_correct);
+    tc_reclaim();
+    remove("test_swap_small.conf");
+    remove("test_swap_big.conf");
+#endif
+
+    // --------------------
+    // tc_read_enter
+    // --------------------
+    printf("\nINIT tc_read_enter tests\n");
+    FILE *epoch_file = fopen("test_epoch_a.conf", "w");
+    fprintf(epoch_file, "window_width = 1280\n");
+    fclose(epoch_file);
+    epoch_file = fopen("test_epoch_b.conf", "w");
+    fprintf(epoch_file, "window_width = 1920\n");
+    for (int line = 1; line < TC_CONFIG_MAX_SIZE; line++)
+        fprintf(epoch_file, "key_%c%c = padding\n", 'a' + line / 26, 'a' + line % 26);
+    fclose(epoch_file);
+
+    tc_config epoch_config = {0};
+    tc_reload_staged(&epoch_config, "test_epoch_a.conf", NULL, NULL, NULL);
+    tc_read_enter();
+    tc_read_enter();
+    const char *epoch_width = tc_get_value(&epoch_config, "window_width");
+    ret = tc_reload_staged(&epoch_config, "test_epoch_b.conf", NULL, NULL, NULL);
+    tc_read_leave();
+    TEST("values stay readable after a reload", ret && STRING_COMPARE(epoch_width, "1280")
+        && STRING_COMPARE(tc_get_value(&epoch_config, "window_width"), "1920"));
+    TEST("retired storage waits for the readers", tc_reclaim() > 0);
+    tc_read_leave();
+    TEST("retired storage is released after the readers", tc_reclaim() == 0);
+
+#ifndef __STDC_NO_THREADS__
+    epoch_reader_context epoch_context = { &epoch_config, false };
+    thrd_t epoch_thread;
+    thrd_create(&epoch_thread, epoch_reader, &epoch_context);
+    bool epoch_reloads = true;
+    for (int i = 0; i < 300; i++)
+        epoch_reloads = tc_reload_staged(&epoch_config, i % 2 ? "test_epoch_b.conf" : "test_epoch_a.conf", NULL, NULL, NULL)
+            && epoch_reloads;
+    thrd_join(epoch_thread, NULL);
+    TEST("readers never see released storage", epoch_reloads && !epoch_context.torn);
+    TEST("reloads don't accumulate retired storage", tc_reclaim() == 0);
+#endif
+    tc_free_config(&epoch_config);
+    remove("test_epoch_a.conf");
+    remove("test_epoch_b.conf");
+
+    // --------------------
+    // tc_subscribe
+    // --------------------
+    printf("\nINIT tc_subscribe tests\n");
+    FILE *subscription_file = fopen("test_subscribe.conf", "w");
+    fprintf(subscription_file, "ip_address = 10.0.0.1\nlog_level = info\nworkers = 4\n");
+    fclose(subscription_file);
+
+    tc_config subscription_config = { .flags = TC_LAZY };
+    tc_load_config(&subscription_config, "test_subscribe.conf");
+    subscription_record ip_record = {0}, level_record = {0}, workers_record = {0}, added_record = {0};
+    tc_subscribe(&subscription_config, "ip_address", subscription_callback, &ip_record);
+    tc_subscribe(&subscription_config, "log_level", subscription_callback, &level_record);
+    tc_subscribe(&subscription_config, "workers", subscription_callback, &workers_record);
+    tc_subscribe(&subscription_config, "added", subscription_callback, &added_record);
+
+    subscription_file = fopen("test_subscribe.conf", "w");
+    fprintf(subscription_file, "# comment\nip_address = 10.0.0.1\nlog_level = debug\nadded = yes\n");
+    fclose(subscription_file);
+    tc_load_config(&subscription_config, "test_subscribe.conf");
+    TEST("unchanged key isn't notified", ip_record.calls == 0);
+    TEST("changed key is notified once", level_record.calls == 1 && STRING_COMPARE(level_record.value, "debug"));
+    TEST("removed key is notified", workers_record.calls == 1 && STRING_COMPARE(workers_record.value, "(removed)"));
+    TEST("added key is notified", added_record.calls == 1 && STRING_COMPARE(added_record.value, "yes"));
+
+    tc_load_config(&subscription_config, "test_subscribe.conf");
+    TEST("same file notifies nothing", level_record.calls == 1 && added_record.calls == 1);
+    tc_set_value(&subscription_config, "ip_address", "10.0.0.2");
+    TEST("tc_set_value notifies its key", ip_record.calls == 1 && level_record.calls == 1);
+    // Both values have the same length and FNV-1a hash.
+    tc_set_value(&subscription_config, "ip_address", "glbvs");
+    tc_set_value(&subscription_config, "ip_address", "yacxa");
+    TEST("values are compared byte by byte", ip_record.calls == 3 && STRING_COMPARE(ip_record.value, "yacxa"));
+    tc_set_value(&subscription_config, "ip_address", "10.0.0.2");
+    tc_unsubscribe(&subscription_config, "log_level", subscription_callback, &level_record);
+    tc_set_value(&subscription_config, "log_level", "warn");
+    TEST("tc_unsubscribe", level_record.calls == 1 && subscription_config.subscription_count == 3);
+
+    // The subscription after one that unsubscribes in its callback is still called.
+    subscription_record self_record = {0}, next_record = {0};
+    tc_subscribe(&subscription_config, "log_level", unsubscribing_callback, &self_record);
+    tc_subscribe(&subscription_config, "log_level", subscription_callback, &next_record);
+    tc_load_config(&subscription_config, "test_subscribe.conf");
+    TEST("callbacks can unsubscribe", self_record.calls == 1 && STRING_COMPARE(self_record.value, "log_level")
+        && next_record.calls == 1 && subscription_config.subscription_count == 4);
+
+    subscription_record writing_record = {0}, nested_record = {0};
+    tc_subscribe(&subscription_config, "ip_address", writing_callback, &writing_record);
+    tc_subscribe(&subscription_config, "added", subscription_callback, &nested_record);
+    tc_set_value(&subscription_config, "ip_address", "10.0.0.3");
+    TEST("callbacks can set values", writing_record.calls == 1 && nested_record.calls == 1
+        && STRING_COMPARE(nested_record.value, "nested"));
+    tc_free_config(&subscription_config);
+    TEST("tc_free_config drops the subscriptions", subscription_config.subscriptions == NULL);
+
+#ifndef __STDC_NO_THREADS__
+    tc_config exclusive_config = {0};
+    tc_load_config(&exclusive_config, "test_subscribe.conf");
+    tc_subscribe(&exclusive_config, "log_level", exclusive_callback, NULL);
+    thrd_t exclusive_threads[2];
+    for (int i = 0; i < 2; i++) thrd_create(&exclusive_threads[i], exclusive_writer, &exclusive_config);
+    for (int i = 0; i < 2; i++) thrd_join(exclusive_threads[i], NULL);
+    TEST("callbacks of concurrent writers don't overlap", exclusive_overlaps == 0);
+    tc_free_config(&exclusive_config);
+#endif
+    remove("test_subscribe.conf");
+
+    // --------------------
+    // tc_queue_set_value
+    // --------------------
+    printf("\nINIT tc_queue_set_value tests\n");
+    FILE *pending_file = fopen("test_pending.conf", "w");
+    fprintf(pending_file, "workers = 4\nlog_level = info\n");
+    fclose(pending_file);
+
+    tc_config pending_config = { .flags = TC_LAZY | TC_LINE_GENERATIONS };
+    tc_load_config(&pending_config, "test_pending.conf");
+    TEST("tc_queue_set_value needs tc_reserve_pending", !tc_queue_set_value(&pending_config, "workers", "8"));
+    tc_reserve_pending(&pending_config, 3);
+
+    bool queued = tc_queue_set_value(&pending_config, "workers", "8")
+        && tc_queue_set_value(&pending_config, "log_level", "debug")
+        && tc_queue_set_value(&pending_config, "missing", "yes")
+        && tc_queue_set_value(&pending_config, "workers", "16");
+    TEST("capacity is rounded to a power of two", queued && !tc_queue_set_value(&pending_config, "workers", "32"));
+    TEST("queued sets wait for tc_apply_pending", STRING_COMPARE(tc_get_value(&pending_config, "workers"), "4"));
+
+    uint32_t pending_generation = tc_generation(&pending_config);
+    TEST("tc_apply_pending skips missing keys", tc_apply_pending(&pending_config) == 3);
+    TEST("sets are applied in order", STRING_COMPARE(tc_get_value(&pending_config, "workers"), "16")
+        && STRING_COMPARE(tc_get_value(&pending_config, "log_level"), "debug"));
+    TEST("one generation per apply", tc_generation(&pending_config) == pending_generation + 1
+        && tc_key_generation(&pending_config, "log_level") == pending_generation + 1);
+    TEST("empty queue applies nothing", tc_apply_pending(&pending_config) == 0
+        && tc_generation(&pending_config) == pending_generation + 1);
+
+#ifndef __STDC_NO_THREADS__
+    tc_reserve_pending(&pending_config, 16);
+    thrd_t producers[4];
+    for (int i = 0; i < 4; i++) thrd_create(&producers[i], pending_producer, &pending_config);
+    size_t pending_applied = 0;
+    while (pending_applied < 4 * 500) pending_applied += tc_apply_pending(&pending_config);
+    for (int i = 0; i < 4; i++) thrd_join(producers[i], NULL);
+    TEST("sets queued from many threads are all applied", pending_applied == 4 * 500
+        && STRING_COMPARE(tc_get_value(&pending_config, "workers"), "500"));
+#endif
+    tc_free_config(&pending_config);
+    TEST("tc_free_config releases the queue", pending_config.pending == NULL);
+
+    // A set whose chunk can't be copied away from a snapshot stays queued.
+    counting_context pending_counting = {0};
+    tc_allocator pending_allocator = { counting_alloc, counting_free, &pending_counting };
+    pending_config = (tc_config) { .flags = TC_GROW, .allocator = &pending_allocator };
+    tc_load_config(&pending_config, "test_pending.conf");
+    tc_reserve_pending(&pending_config, 4);
+    tc_config *pending_snapshot = tc_snapshot(&pending_config);
+    tc_queue_set_value(&pending_config, "workers", "8");
+    tc_queue_set_value(&pending_config, "log_level", "debug");
+    pending_counting.refuse = true;
+    size_t refused = tc_apply_pending(&pending_config);
+    pending_counting.refuse = false;
+    TEST("a failed set stays queued", refused == 0
+        && STRING_COMPARE(tc_get_value(&pending_config, "workers"), "4")
+        && tc_apply_pending(&pending_config) == 2
+        && STRING_COMPARE(tc_get_value(&pending_config, "workers"), "8")
+        && STRING_COMPARE(tc_get_value(&pending_config, "log_level"), "debug"));
+    tc_snapshot_release(pending_snapshot);
+    tc_free_config(&pending_config);
+    TEST("tc_free_config releases the queue after a failed set", pending_config.pending == NULL);
+    remove("test_pending.conf");
+
+    // --------------------
+    // tc_txn
+    // --------------------
+    printf("\nINIT tc_txn tests\n");
+    FILE *txn_file = fopen("test_txn.conf", "w");
+    fprintf(txn_file, "window_width = 1280\nwindow_height = 720\nvsync = on\n");
+    fclose(txn_file);
+
+    tc_config txn_config = { .flags = TC_VIEW | TC_LINE_GENERATIONS };
+    tc_load_config(&txn_config, "test_txn.conf");
+    uint32_t txn_generation = tc_generation(&txn_config);
+
+    tc_txn txn;
+    tc_txn_begin(&txn_config, &txn);
+    for (int i = 0; i < 6; i++) tc_txn_set(&txn, "vsync", i % 2 ? "on" : "off");
+    tc_txn_set(&txn, "window_width", "1920");
+    tc_txn_set(&txn, "window_height", "1080");
+    TEST("tc_txn_set doesn't touch the config", txn.count == 8
+        && STRING_COMPARE(tc_get_value(&txn_config, "window_width"), "1280"));
+    ret = tc_txn_commit(&txn);
+    TEST("tc_txn_commit writes every change", ret
+        && STRING_COMPARE(tc_get_value(&txn_config, "window_width"), "1920")
+        && STRING_COMPARE(tc_get_value(&txn_config, "window_height"), "1080")
+        && STRING_COMPARE(tc_get_value(&txn_config, "vsync"), "on"));
+    TEST("one generation per commit", tc_generation(&txn_config) == txn_generation + 1
+        && tc_key_generation(&txn_config, "window_height") == txn_generation + 1
+        && txn.changes == NULL);
+
+    tc_txn_begin(&txn_config, &txn);
+    tc_txn_set(&txn, "window_width", "800");
+    tc_txn_set(&txn, "window_depth", "32");
+    TEST("a missing key fails the commit", !tc_txn_commit(&txn)
+        && STRING_COMPARE(tc_get_value(&txn_config, "window_width"), "1920")
+        && tc_generation(&txn_config) == txn_generation + 1);
+
+    tc_txn_begin(&txn_config, &txn);
+    tc_txn_set(&txn, "window_width", "800");
+    bool txn_overflow = !tc_txn_set(&txn, "window_height", "0123456789012345678901234567890123456789012345678901234567890");
+    TEST("an overflowing value fails the commit", txn_overflow && !tc_txn_commit(&txn)
+        && STRING_COMPARE(tc_get_value(&txn_config, "window_width"), "1920"));
+
+    tc_txn_begin(&txn_config, &txn);
+    tc_txn_set(&txn, "window_width", "800");
+    tc_txn_abort(&txn);
+    TEST("tc_txn_abort writes nothing", STRING_COMPARE(tc_get_value(&txn_config, "window_width"), "1920"));
+
+    const char *txn_keys[] = { "window_width", "window_depth", "window_height" };
+    tc_str txn_values[3];
+    char txn_buffer[16];
+    size_t txn_copied = tc_get_values_copy(&txn_config, txn_keys, txn_values, 3, txn_buffer, sizeof(txn_buffer));
+    TEST("tc_get_values_copy", txn_copied == 2 && STRING_COMPARE(txn_values[0].ptr, "1920")
+        && txn_values[1].ptr == NULL && STRING_COMPARE(txn_values[2].ptr, "1080") && txn_values[2].len == 4);
+    txn_copied = tc_get_values_copy(&txn_config, txn_keys, txn_values, 3, txn_buffer, 8);
+    TEST("tc_get_values_copy small buffer", txn_copied == 1 && txn_values[2].ptr == NULL);
+#ifndef __STDC_NO_THREADS__
+    thrd_t txn_thread;
+    thrd_create(&txn_thread, txn_writer, &txn_config);
+    bool txn_whole = true;
+    for (int i = 0; i < 20000; i++)
+    {
+        tc_get_values_copy(&txn_config, txn_keys, txn_values, 3, txn_buffer, sizeof(txn_buffer));
+        bool wide = STRING_COMPARE(txn_values[0].ptr, "1920") && STRING_COMPARE(txn_values[2].ptr, "1080");
+        bool narrow = STRING_COMPARE(txn_values[0].ptr, "1280") && STRING_COMPARE(txn_values[2].ptr, "720");
+        txn_whole = txn_whole && (wide || narrow);
+    }
+    thrd_join(txn_thread, NULL);
+    TEST("tc_get_values_copy sees whole transactions", txn_whole);
+#endif
+    tc_free_config(&txn_config);
+    remove("test_txn.conf");
+
+    // --------------------
+    // tc_snapshot
+    // --------------------
+    printf("\nINIT tc_snapshot tests\n");
+    FILE *snapshot_file = fopen("test_snapshot.conf", "w");
+    for (int i = 0; i < 100; i++)
+        fprintf(snapshot_file, "key_%c%c = value_%d\n", 'a' + i / 26, 'a' + i % 26, i);
+    fclose(snapshot_file);
+
+    const unsigned int snapshot_flags[] = { TC_GROW, TC_GROW | TC_LAZY, TC_GROW | TC_VIEW, TC_GROW | TC_PROFILE };
+    bool snapshot_shares = true, snapshot_copies_chunk = true, snapshot_survives = true;
+    for (size_t i = 0; i < sizeof(snapshot_flags) / sizeof(snapshot_flags[0]); i++)
+    {
+        tc_config live_config = { .flags = snapshot_flags[i] };
+        tc_load_config(&live_config, "test_snapshot.conf");
+        tc_config *snapshot = tc_snapshot(&live_config);
+        snapshot_shares = snapshot_shares && snapshot != NULL && snapshot->chunks == live_config.chunks
+            && STRING_COMPARE(tc_get_value(snapshot, "key_dv"), "value_99");
+
+        tc_set_value(&live_config, "key_ab", "changed");
+        snapshot_copies_chunk = snapshot_copies_chunk
+            && STRING_COMPARE(tc_get_value(&live_config, "key_ab"), "changed")
+            && STRING_COMPARE(tc_get_value(snapshot, "key_ab"), "value_1")
+            && live_config.chunks[0] != snapshot->chunks[0]
+            && live_config.chunks[1] == snapshot->chunks[1];
+
+        tc_config *second = tc_snapshot(&live_config);
+        if (live_config.flags & TC_PROFILE)
+        {
+            tc_get_value(&live_config, "key_dv");
+            tc_optimize_layout(&live_config);
+        }
+        tc_load_config(&live_config, "test.conf");
+        tc_snapshot_release(tc_snapshot_retain(snapshot));
+        snapshot_survives = snapshot_survives && tc_get_value(&live_config, "key_ab") == NULL
+            && STRING_COMPARE(tc_get_value(snapshot, "key_ab"), "value_1")
+            && STRING_COMPARE(tc_get_value(second, "key_ab"), "changed")
+            && STRING_COMPARE(tc_get_value(second, "key_dv"), "value_99");
+
+        tc_snapshot_release(snapshot);
+        tc_free_config(&live_config);
+        snapshot_survives = snapshot_survives && STRING_COMPARE(tc_get_value(second, "key_aa"), "value_0");
+        tc_snapshot_release(second);
+    }
+    TEST("tc_snapshot shares the chunks", snapshot_shares);
+    TEST("tc_set_value copies only its chunk", snapshot_copies_chunk);
+    TEST("snapshots outlive loads and tc_free_config", snapshot_survives);
+
+    tc_config static_config = {0};
+    tc_load_config(&static_config, "test.conf");
+    TEST("tc_snapshot needs TC_GROW", tc_snapshot(&static_config) == NULL);
+    tc_free_config(&static_config);
+    remove("test_snapshot.conf");
+
+    // --------------------
+    // TC_PROFILE
+    // --------------------
+    printf("\nINIT TC_PROFILE tests\n");
+    tc_config profile_config = { .flags = TC_PROFILE | TC_LINE_GENERATIONS };
+    ret = tc_load_config(&profile_config, "test.conf");
+    TEST("profile tc_load_config success return", ret == true && profile_config.access_counts != NULL);
+    for (int i = 0; i < 3; i++) tc_get_value(&profile_config, "dotted_text");
+    for (int i = 0; i < 2; i++) tc_get_value_sv(&profile_config, "random_text");
+    TEST("reads are counted", profile_config.access_counts[7] == 3 && profile_config.access_counts[6] == 2);
+    tc_set_value(&profile_config, "dotted_text", "com.domain.example");
+    ret = tc_optimize_layout(&profile_config);
+    char *first_line  = (char *) profile_config.buffer + TC_HEADER_SIZE;
+    char *second_line = (char *) profile_config.buffer + TC_LINE_TOTAL_SIZE + TC_HEADER_SIZE;
+    TEST("hottest line comes first", ret == true && strncmp(first_line, "dotted_text=", 12) == 0);
+    TEST("second hottest line", strncmp(second_line, "random_text=", 12) == 0);
+    TEST("counts follow their lines", profile_config.access_counts[0] == 3);
+    TEST("line generations follow their lines", tc_key_generation(&profile_config, "dotted_text") == 2
+        && tc_key_generation(&profile_config, "ip_address") == 1);
+    test_config_values(&profile_config);
+
+    uint32_t profile_hashes[TC_CONFIG_MAX_SIZE];
+    size_t profile_count = tc_export_profile(&profile_config, profile_hashes, TC_CONFIG_MAX_SIZE);
+    TEST("tc_export_profile exports every key", profile_count == 8);
+    tc_free_config(&profile_config);
+    TEST("tc_free_config releases the counts", profile_config.access_counts == NULL);
+
+    tc_config profiled_config = { .profile = { profile_hashes, profile_count } };
+    ret = tc_load_config(&profiled_config, "test.conf");
+    first_line = (char *) profiled_config.buffer + TC_HEADER_SIZE;
+    TEST("profile is applied at load", ret == true && strncmp(first_line, "dotted_text=", 12) == 0);
+    test_config_values(&profiled_config);
+    tc_free_config(&profiled_config);
+
+    // --------------------
+    // TC_READ_CACHE
+    // --------------------
+    printf("\nINIT TC_READ_CACHE tests\n");
+    tc_config cache_config = { .flags = TC_READ_CACHE | TC_PROFILE | TC_GROW };
+    ret = tc_load_config(&cache_config, "test.conf");
+    test_config_values(&cache_config);
+    test_config_values(&cache_config);
+    const char *cached = tc_get_value(&cache_config, "dotted_text");
+    TEST("cached value is the value of the line", ret == true && cached == tc_get_value_sv(&cache_config, "dotted_text").ptr
+        && tc_get_value_sv(&cache_config, "dotted_text").len == 18);
+    TEST("cached reads are counted", cache_config.access_counts[7] == 5);
+    TEST("missing keys aren't cached", tc_get_value(&cache_config, "dotted") == NULL
+        && tc_get_value(&cache_config, "dotted") == NULL);
+    tc_set_value(&cache_config, "dotted_text", "org.domain.example");
+    TEST("tc_set_value invalidates the cache", STRING_COMPARE(tc_get_value(&cache_config, "dotted_text"), "org.domain.example"));
+    tc_optimize_layout(&cache_config);
+    TEST("tc_optimize_layout invalidates the cache", STRING_COMPARE(tc_get_value(&cache_config, "dotted_text"), "org.domain.example")
+        && STRING_COMPARE(tc_get_value(&cache_config, "ip_address"), "172.165.10.02"));
+
+    // Loaded again at the same address and generation.
+    tc_free_config(&cache_config);
+    cache_config = (tc_config) { .flags = TC_READ_CACHE | TC_GROW | TC_VIEW };
+    tc_load_config(&cache_config, "test.conf");
+    tc_load_config(&cache_config, "test.conf");
+    TEST("cache entries of released configs are stale", tc_generation(&cache_config) == 2
+        && STRING_COMPARE(tc_get_value(&cache_config, "dotted_text"), "com.domain.example"));
+    test_config_values(&cache_config);
+#ifndef __STDC_NO_THREADS__
+    thrd_t cache_thread;
+    int cache_correct = 0;
+    thrd_create(&cache_thread, cache_reader, &cache_config);
+    thrd_join(cache_thread, &cache_correct);
+    TEST("every thread has its own cache", cache_correct);
+#endif
+    tc_free_config(&cache_config);
+
+    // Cleared without tc_free_config and loaded again at the same address and generation.
+    FILE *cache_file = fopen("test_cache_a.conf", "w");
+    fprintf(cache_file, "cache_key = first\n");
+    fclose(cache_file);
+    cache_file = fopen("test_cache_b.conf", "w");
+    fprintf(cache_file, "cache_key = second_value\n");
+    fclose(cache_file);
+    cache_config = (tc_config) { .flags = TC_READ_CACHE };
+    tc_load_config(&cache_config, "test_cache_a.conf");
+    tc_get_value_sv(&cache_config, "cache_key");
+    tc_config cleared_config = cache_config;
+    cache_config = (tc_config) { .flags = TC_READ_CACHE };
+    tc_load_config(&cache_config, "test_cache_b.conf");
+    TEST("cache entries of cleared configs are stale", tc_generation(&cache_config) == tc_generation(&cleared_config)
+        && tc_get_value_sv(&cache_config, "cache_key").len == 12);
+    tc_free_config(&cleared_config);
+    tc_free_config(&cache_config);
+    remove("test_cache_a.conf");
+    remove("test_cache_b.conf");
+
+    // --------------------
+    // tc_load_directory
+    // --------------------
+    printf("\nINIT tc_load_directory tests\n");
+    tc_config directory_config = {0};
+    ret = tc_load_directory(&directory_config, "conf.d", "*.conf");
+    TEST("tc_load_directory success return", ret == true);
+    TEST("directory config->size = 3", directory_config.size == 3);
+    TEST("later file overrides", STRING_COMPARE(tc_get_value(&directory_config, "ip_address"), "172.165.10.02"));
+    TEST("first file value", STRING_COMPARE(tc_get_value(&directory_config, "numberOfMacros"), "2"));
+    TEST("later file value", STRING_COMPARE(tc_get_value(&directory_config, "programsafety"), "unsafe"));
+    ret = tc_load_directory(&directory_config, "conf.d", "*.none");
+    TEST("tc_load_directory without matches", ret == true && directory_config.size == 0);
+
+    // Keys without a value at the end of the files still need a line while lexing.
+    FILE *bare_directory_file = fopen("conf.d/30-bare.bare", "w");
+    fprintf(bare_directory_file, "bare\n");
+    fclose(bare_directory_file);
+    bare_directory_file = fopen("conf.d/40-last.bare", "w");
+    fprintf(bare_directory_file, "a = 1\nb\n");
+    fclose(bare_directory_file);
+    tc_config bare_directory_config = {0};
+    tc_load_directory(&bare_directory_config, "conf.d", "*.bare");
+    TEST("tc_load_directory bare last keys",
+        STRING_COMPARE(tc_get_value(&bare_directory_config, "a"), "1"));
+    tc_free_config(&bare_directory_config);
+    remove("conf.d/30-bare.bare");
+    remove("conf.d/40-last.bare");
+
+    // --------------------
+    // tc_load_configs
+    // --------------------
+    printf("\nINIT tc_load_configs tests\n");
+    const char *batch_paths[] = { "test.conf", "conf.d/10-base.conf", "missing.conf", "conf.d/20-override.conf" };
+    tc_config batch_configs[4] = { [3] = { .flags = TC_VIEW } };
+    ret = tc_load_configs(batch_configs, batch_paths, 4);
+    TEST("tc_load_configs fails with a missing file", ret == false);
+    test_config_values(&batch_configs[0]);
+    TEST("batch configs own their storage", batch_configs[0].buffer != batch_configs[1].buffer);
+    TEST("batch config->size = 3", batch_configs[1].size == 3);
+    TEST("batch first line wins", STRING_COMPARE(tc_get_value(&batch_configs[1], "numberOfMacros"), "2"));
+    TEST("batch missing file is empty", batch_configs[2].size == 0 && batch_configs[2].buffer == NULL);
+    TEST("batch view", STRING_COMPARE(tc_get_value(&batch_configs[3], "ip_address"), "172.165.10.02"));
+    for (size_t i = 0; i < 4; i++)
+        tc_free_config(&batch_configs[i]);
+    TEST("tc_free_config releases owned storage", batch_configs[0].buffer == NULL);
+
+    // The key of a last line without a value needs a line of its own while lexing.
+    FILE *bare_file = fopen("test_bare.conf", "w");
+    fprintf(bare_file, "a = 1\nb\n");
+    fclose(bare_file);
+    const char *bare_paths[] = { "test_bare.conf" };
+    tc_config bare_configs[1] = {0};
+    ret = tc_load_configs(bare_configs, bare_paths, 1);
+    TEST("batch bare last key", STRING_COMPARE(tc_get_value(&bare_configs[0], "a"), "1"));
+    tc_free_config(&bare_configs[0]);
+    ret = tc_reload_staged(&bare_configs[0], "test_bare.conf", NULL, NULL, NULL);
+    TEST("staged bare last key", STRING_COMPARE(tc_get_value(&bare_configs[0], "a"), "1"));
+    tc_free_config(&bare_configs[0]);
+
+    // A buffer that fits the file exactly reads one more byte to find the end of the file.
+    char exact_scratch[sizeof("a = 1\nb\n")];
+    tc_set_scratch(&bare_configs[0], exact_scratch, sizeof(exact_scratch));
+    ret = tc_load_configs(bare_configs, bare_paths, 1);
+    TEST("batch file filling the scratch buffer", ret == true
+        && STRING_COMPARE(tc_get_value(&bare_configs[0], "a"), "1"));
+    tc_free_config(&bare_configs[0]);
+    remove("test_bare.conf");
+
+#ifdef __linux__
+    // Files of /proc have a size of 0, they're read until the end like a file that grew.
+    const char *proc_paths[] = { "/proc/self/comm" };
+    tc_config proc_configs[1] = {0};
+    ret = tc_load_configs(proc_configs, proc_paths, 1);
+    TEST("batch file bigger than its size", ret == true);
+    tc_free_config(&proc_configs[0]);
+#endif
+
+    // --------------------
+    // tc_allocator
+    // --------------------
+    printf("\nINIT tc_allocator tests\n");
+    counting_context config_counting = {0};
+    tc_allocator config_allocator = { counting_alloc, counting_free, &config_counting };
+    tc_config allocator_config = { .flags = TC_VIEW, .allocator = &config_allocator };
+    tc_load_config(&allocator_config, "test.conf");
+    tc_load_config(&allocator_config, "test.conf");
+    test_config_values(&allocator_config);
+    TEST("config allocator is used", config_counting.allocations > 0 && config_counting.bytes > 0);
+    tc_free_config(&allocator_config);
+    tc_reclaim();
+    TEST("config allocator memory is released", config_counting.bytes == 0 && config_counting.wrong_sizes == 0);
+
+    // Once the storage and both records exist, reloads reuse them.
+    const unsigned int steady_flags[] = { 0, TC_VIEW };
+    bool steady_reloads = true;
+    for (size_t i = 0; i < sizeof(steady_flags) / sizeof(steady_flags[0]); i++)
+    {
+        counting_context steady_counting = {0};
+        tc_allocator steady_allocator = { counting_alloc, counting_free, &steady_counting };
+        tc_config steady_config = { .flags = steady_flags[i], .allocator = &steady_allocator };
+        for (int load = 0; load < 3; load++)
+            tc_load_config(&steady_config, "test.conf");
+        long allocations = steady_counting.allocations;
+        for (int load = 0; load < 100; load++)
+            steady_reloads = tc_load_config(&steady_config, "test.conf") && steady_reloads;
+        steady_reloads = steady_reloads && steady_counting.allocations == allocations;
+        tc_free_config(&steady_config);
+        tc_reclaim();
+        steady_reloads = steady_reloads && steady_counting.bytes == 0;
+    }
+    TEST("steady reloads don't touch the allocator", steady_reloads);
+
+    counting_context global_counting = {0};
+    tc_allocator global_allocator = { counting_alloc, counting_free, &global_counting };
+    tc_set_allocator(&global_allocator);
+    tc_config allocator_configs[2] = {0};
+    ret = tc_load_configs(allocator_configs, batch_paths, 2);
+    TEST("global allocator tc_load_configs", ret == true && global_counting.bytes > 0);
+    ret = tc_load_directory(&directory_config, "conf.d", "*.conf");
+    TEST("global allocator tc_load_directory", ret == true && directory_config.size == 3);
+    tc_free_config(&allocator_configs[0]);
+    tc_free_config(&allocator_configs[1]);
+    tc_free_config(&directory_config);
+    tc_reclaim();
+    tc_set_allocator(NULL);
+    TEST("global allocator memory is released", global_counting.bytes == 0 && global_counting.wrong_sizes == 0);
+
+    // Without memory for the retired list, the records are released once the readers left.
+    counting_context refusing_counting = { .refuse = true };
+    tc_allocator refusing_allocator = { counting_alloc, counting_free, &refusing_counting };
+    counting_context retire_counting = {0};
+    tc_allocator retire_allocator = { counting_alloc, counting_free, &retire_counting };
+    tc_config retire_config = { .allocator = &retire_allocator };
+    tc_load_config(&retire_config, "test.conf");
+    tc_load_config(&retire_config, "test.conf");
+    tc_set_allocator(&refusing_allocator);
+    tc_free_config(&retire_config);
+    tc_set_allocator(NULL);
+    TEST("full retired list releases after the readers", retire_counting.bytes == 0 && tc_reclaim() == 0);
+
+    // --------------------
+    // tinyconfig_embed
+    // --------------------
+    printf("\nINIT tinyconfig_embed tests\n");
+    TEST("embedded config->size = 8", test_conf.size == 8);
+    test_config_values(&test_conf);
 
     return 0;
 }
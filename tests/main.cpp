@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <cstring>
+
+#include "tinyconfig.hpp"
+
+#define GREEN(string) "\033[0;32m" string "\033[0m"
+#define RED(string)   "\033[0;31m" string "\033[0m"
+
+#define TEST(test_name, condition)    \
+    printf("TEST " test_name "... "); \
+    if (condition) printf(GREEN("SUCCESS")"\n"); else printf(RED("FAILED")"\n")
+
+#define STRING_COMPARE(x, y) ((x) != nullptr && strcmp(x, y) == 0)
+
+int main() {
+    printf("INIT C++ TESTS\n");
+
+    // --------------------
+    // tc::basic_config
+    // --------------------
+    printf("\nINIT tc::basic_config tests\n");
+
+    tc::basic_config<8, 64> config;
+    TEST("load test.conf", config.load("test.conf"));
+    TEST("size = 8", config.size() == 8);
+    TEST("Dot separated numbers", STRING_COMPARE(config.get("ip_address"), "172.165.10.02"));
+    TEST("Text with white spaces", STRING_COMPARE(config.get("random_text"), "Some whitespaced random text"));
+    TEST("Dotted text view", config.get_view("dotted_text") == "com.domain.example");
+    TEST("Missing key", config.get("ip") == nullptr);
+
+    config.set("programsafety", "very_safe");
+    TEST("set raw string very_safe", STRING_COMPARE(config.get("programsafety"), "very_safe"));
+
+    tc::basic_config<4, 64> small_config;
+    TEST("MaxLines overflow fails", !small_config.load("test.conf"));
+
+    tc::basic_config<8, 16> narrow_config;
+    TEST("uint8_t header for small lines", sizeof(decltype(narrow_config)::header_type) == 1);
+    TEST("LineSize overflow fails", !narrow_config.load("test.conf"));
+
+    using namespace std::string_view_literals;
+    tc::detail::parse_error null_error = config.parse("window_width = 1920\nwindow_title = ab\0cd\n"sv);
+    TEST("null byte in a value is a value error", null_error && null_error.line == 1
+        && STRING_COMPARE(null_error.message, "value has an illegal character"));
+
+    // --------------------
+    // tc::embedded
+    // --------------------
+    printf("\nINIT tc::embedded tests\n");
+
+    static constexpr auto &embedded = tc::embedded<R"(
+# Default window
+window_width = 800
+window_height=600
+window_title = Some title text   # trailing comment
+window_width = 1024
+)">;
+    static_assert(embedded.size() == 4);
+    static_assert(embedded.get_view("window_height") == "600");
+
+    TEST("embedded size = 4", embedded.size() == 4);
+    TEST("embedded first duplicate wins", STRING_COMPARE(embedded.get("window_width"), "800"));
+    TEST("embedded trimmed value", STRING_COMPARE(embedded.get("window_title"), "Some title text"));
+    TEST("embedded line", STRING_COMPARE(embedded.line(1), "window_height=600"));
+    TEST("embedded missing key", embedded.get("window") == nullptr);
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Copyright 2023-2024 Alexandre Parra
+// MIT License
+// tinyconfig
+
+/*
+    tinyconfig_embed parses a configuration file with tc_load_config and writes a C source file
+    holding the ready-made line buffer and hash index, so that the configuration can be linked
+    into a program and used as a tc_config without any work at startup. The file is parsed into
+    a TC_GROW config, so the TC_CONFIG_MAX_SIZE of the tool doesn't limit it:
+
+        tinyconfig_embed tiny.conf tiny_conf.c tiny_conf
+
+    The generated file defines `tc_config tiny_conf`, declare it with `extern tc_config tiny_conf;`
+    to use it. The tool must be built with the same TC_LINE_MAX_SIZE as the program that links the
+    generated file, and the program's TC_CONFIG_MAX_SIZE must hold every line of the file, both
+    are checked by static assertions in the generated file.
+
+    Normally this tool is used through the tinyconfig_embed CMake function.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tinyconfig.h>
+
+#define ERROR_REPORT(string, ...) fprintf(        \
+        stderr,                                       \
+        "\033[0;31m tinyconfig_embed: " string "\033[0m\n", \
+        __VA_ARGS__)
+
+/// Write a line as a C string literal, escaping everything that isn't printable ASCII.
+static void write_string(FILE *output, const char *line)
+{
+    fputc('"', output);
+    for (const unsigned char *c = (const unsigned char *) line; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\') fprintf(output, "\\%c", *c);
+        else if (*c < 32 || *c > 126 || *c == '?') fprintf(output, "\\%03o", *c);
+        else fputc(*c, output);
+    }
+    fputc('"', output);
+}
+
+static size_t line_offset(const char *line)
+{
+    tc_line_header header;
+    memcpy(&header, line, sizeof(header));
+#ifdef TC_COMPACT_HEADER
+    return header.offset;
+#else
+    return header & TC_HEADER_OFFSET_MASK;
+#endif
+}
+
+static size_t line_length(const char *line)
+{
+    tc_line_header header;
+    memcpy(&header, line, sizeof(header));
+#ifdef TC_COMPACT_HEADER
+    return header.length;
+#else
+    return header >> TC_HEADER_LENGTH_SHIFT;
+#endif
+}
+
+/// Slot of a line of the TC_GROW config, inside of its chunk.
+static char *line_slot(tc_config *config, size_t line)
+{
+    char *chunk = config->chunks[line / TC_GROW_CHUNK_LINES];
+    return chunk + (TC_LINE_TOTAL_SIZE * (line % TC_GROW_CHUNK_LINES));
+}
+
+/// Hash of the key of a line, taken from the index entry of the first line with the same key.
+static uint32_t line_hash(tc_config *config, size_t line)
+{
+    const char *key = line_slot(config, line) + TC_HEADER_SIZE;
+    size_t key_length = line_offset(key - TC_HEADER_SIZE) - 1;
+
+    for (size_t i = 0; i < config->index_size; i++)
+    {
+        tc_index_entry entry = config->index[i];
+        if (entry.line == 0) continue;
+
+        const char *indexed = line_slot(config, entry.line - 1);
+        if (line_offset(indexed) - 1 == key_length && memcmp(indexed + TC_HEADER_SIZE, key, key_length) == 0)
+            return entry.hash;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        ERROR_REPORT("usage: %s <input.conf> <output.c> <symbol name>", argv[0]);
+        return 1;
+    }
+
+    const char *input_path  = argv[1];
+    const char *output_path = argv[2];
+    const char *name        = argv[3];
+
+    tc_config config = { .flags = TC_GROW };
+    if (!tc_load_config(&config, input_path))
+    {
+        ERROR_REPORT("failed to load %s", input_path);
+        tc_free_config(&config);
+        return 1;
+    }
+
+    // Keep at least one line and two index entries so that no array is empty.
+    size_t lines      = config.size > 0 ? config.size : 1;
+    size_t index_size = lines * 2;
+    tc_index_entry *index = calloc(index_size, sizeof(tc_index_entry));
+    FILE *output = index != NULL ? fopen(output_path, "w") : NULL;
+    if (output == NULL)
+    {
+        ERROR_REPORT("failed to open %s", output_path);
+        free(index);
+        tc_free_config(&config);
+        return 1;
+    }
+
+    fprintf(output, "// Generated by tinyconfig_embed from %s, do not edit.\n\n", input_path);
+    fprintf(output, "#include <stddef.h>\n\n#include <tinyconfig.h>\n\n");
+    fprintf(output,
+        "_Static_assert(TC_LINE_MAX_SIZE == %d, \"%s was generated with TC_LINE_MAX_SIZE=%d\");\n\n",
+        TC_LINE_MAX_SIZE, name, TC_LINE_MAX_SIZE
+    );
+    fprintf(output,
+        "_Static_assert(TC_CONFIG_MAX_SIZE >= %zu, \"%s has %zu lines, more than TC_CONFIG_MAX_SIZE\");\n\n",
+        lines, name, lines
+    );
+
+    // The lines are written as a struct matching one TC_LINE_TOTAL_SIZE slot, and the headers with
+    // TC_HEADER_INIT, so that the header gets the layout, size and endianness of the target.
+    fprintf(output,
+        "typedef struct {\n    tc_line_header header;\n    char line[TC_LINE_TOTAL_SIZE - TC_HEADER_SIZE];\n} %s_line;\n\n",
+        name
+    );
+    fprintf(output,
+        "_Static_assert(sizeof(%s_line) == TC_LINE_TOTAL_SIZE, \"unexpected line padding\");\n\n",
+        name
+    );
+
+    fprintf(output, "static %s_line %s_buffer[%zu] = {\n", name, name, lines);
+    for (size_t i = 0; i < config.size; i++)
+    {
+        char *line = line_slot(&config, i);
+        fprintf(output, "    { TC_HEADER_INIT(%zu, %zu, %u), ",
+            line_offset(line),
+            line_length(line),
+            (unsigned) TC_HEADER_HASH(line_hash(&config, i))
+        );
+        write_string(output, line + TC_HEADER_SIZE);
+        fprintf(output, " },\n");
+    }
+    fprintf(output, "};\n\n");
+
+    // Re-index the lines for the exact size of the generated index, using the same hash that was
+    // computed by the library.
+    for (size_t i = 0; i < config.index_size; i++)
+    {
+        tc_index_entry entry = config.index[i];
+        if (entry.line == 0) continue;
+
+        size_t position = entry.hash % index_size;
+        while (index[position].line != 0) position = (position + 1) % index_size;
+        index[position] = entry;
+    }
+
+    fprintf(output, "static tc_index_entry %s_index[%zu] = {\n", name, index_size);
+    for (size_t i = 0; i < index_size; i++)
+        fprintf(output, "    { %luu, %luu },\n", (unsigned long) index[i].hash, (unsigned long) index[i].line);
+    fprintf(output, "};\n\n");
+
+    fprintf(output,
+        "tc_config %s = {\n    .buffer     = %s_buffer,\n    .size       = %zu,\n"
+        "    .index      = %s_index,\n    .index_size = %zu,\n};\n",
+        name, name, config.size, name, index_size
+    );
+
+    fclose(output);
+    free(index);
+    tc_free_config(&config);
+    return 0;
+}